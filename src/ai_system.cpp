@@ -5,16 +5,21 @@
 #define SDL_MAIN_HANDLED
 #include <SDL.h>
 #include <SDL_mixer.h>
-#include <queue>
-#include <unordered_map>
 #include "world_system.hpp"
 #include "world_init.hpp"
 #include "physics_system.hpp"
+#include "command_buffer.hpp"
+#include "spatial_index.hpp"
+#include "flow_field.hpp"
 
-extern bool line_intersects(const vec2 &a1, const vec2 &a2, const vec2 &b1, const vec2 &b2);
 
 extern std::vector<std::vector<int>> level_grid;
 float MINION_SPEED = 80.f;
+// time the pathfinding may take per AI step, and how far the player may move before the minions' path is replanned
+float PATH_BUDGET_US = 50.f;
+float PATH_REPLAN_DISTANCE = TILE_SCALE;
+// how many tiles ahead on their path the minions look for one they can walk to in a straight line
+int PATH_LOOKAHEAD_TILES = 6;
 
 bool isWalkable(int x, int y)
 {
@@ -25,6 +30,40 @@ bool isWalkable(int x, int y)
 	return false;
 }
 
+// True if a box of half_size can move in a straight line from 'from' to 'to' over walkable tiles only.
+// Checks every tile the moving box overlaps (a supercover of the line widened by the box) row by row: the part of the
+// line during which the box overlaps a row of tiles gives the columns it covers there. Touching a tile does not count.
+bool isLineWalkable(vec2 from, vec2 to, vec2 half_size)
+{
+	const float EPSILON = 0.01f;
+	vec2 d = to - from;
+	int row0 = (int)floor((std::min(from.y, to.y) - half_size.y + EPSILON) / TILE_SCALE);
+	int row1 = (int)floor((std::max(from.y, to.y) + half_size.y - EPSILON) / TILE_SCALE);
+	for (int row = row0; row <= row1; row++)
+	{
+		float t0 = 0.f, t1 = 1.f;
+		if (std::abs(d.y) > EPSILON)
+		{
+			float ta = (row * TILE_SCALE - half_size.y + EPSILON - from.y) / d.y;
+			float tb = ((row + 1) * TILE_SCALE + half_size.y - EPSILON - from.y) / d.y;
+			t0 = std::max(std::min(ta, tb), 0.f);
+			t1 = std::min(std::max(ta, tb), 1.f);
+			if (t0 > t1)
+				continue;
+		}
+		float xa = from.x + d.x * t0;
+		float xb = from.x + d.x * t1;
+		int col0 = (int)floor((std::min(xa, xb) - half_size.x + EPSILON) / TILE_SCALE);
+		int col1 = (int)floor((std::max(xa, xb) + half_size.x - EPSILON) / TILE_SCALE);
+		for (int col = col0; col <= col1; col++)
+		{
+			if (!isWalkable(col, row))
+				return false;
+		}
+	}
+	return true;
+}
+
 float distance_squared(vec2 a, vec2 b)
 {
 	return pow(a.x - b.x, 2) + pow(a.y - b.y, 2);
@@ -68,7 +107,7 @@ void AISystem::perform_chef_attack(ChefAttack attack)
 		float dash_speed = 500.f;
 
 		vec2 direction = normalize(player_position - chef_position);
-		chef_motion.velocity = direction * dash_speed;
+		set_velocity(chef_entity, direction * dash_speed);
 	}
 }
 
@@ -267,6 +306,7 @@ void AISystem::process_prince_attack(float elapsed_ms)
 				vec2 player_position = player_motion.position + player_motion.bb_offset;
 				float teleport_target_side = player_motion.position.x > prince_motion.position.x ? 1.f : -1.f;
 				prince_motion.position = player_position + vec2(teleport_target_side * (abs(prince.original_scale.x) * 0.5f + 50.f), 0.f) - prince_motion.bb_offset;
+				renderer->snap_previous_tick(prince_entity);
 			}
 		}
 		else if (!prince.has_fired)
@@ -337,7 +377,7 @@ void AISystem::process_prince_attack(float elapsed_ms)
 				int tileY = static_cast<int>(position.y / 60);
 				if (isWalkable(tileX, tileY))
 				{
-					createSoldier(renderer, position, soldier_health, soldier_damage);
+					commands.spawn([=]() { createSoldier(renderer, position, soldier_health, soldier_damage); });
 				}
 			}
 		}
@@ -381,7 +421,7 @@ void AISystem::perform_king_attack(KingAttack attack)
 	case KingAttack::LASER:
 	{
 		std::cout << "Laser attack" << std::endl;
-		if ((unsigned int)king.laser_entity != 0)
+		if (king.laser_entity.is_alive())
 		{
 			registry.remove_all_components_of(king.laser_entity);
 			king.laser_entity = Entity(0);
@@ -422,7 +462,7 @@ void AISystem::perform_king_attack(KingAttack attack)
 			int tileY = static_cast<int>(position.y / 60);
 			if (isWalkable(tileX, tileY))
 			{
-				createSoldier(renderer, position, soldier_health, soldier_damage);
+				commands.spawn([=]() { createSoldier(renderer, position, soldier_health, soldier_damage); });
 			}
 		}
 
@@ -433,7 +473,7 @@ void AISystem::perform_king_attack(KingAttack attack)
 	}
 	case KingAttack::FIRE_RAIN:
 	{
-		if ((unsigned int)king.fire_rain_entity != 0)
+		if (king.fire_rain_entity.is_alive())
 		{
 			registry.remove_all_components_of(king.fire_rain_entity);
 			king.fire_rain_entity = Entity(0);
@@ -501,7 +541,7 @@ void AISystem::perform_king_attack(KingAttack attack)
 			int tileY = static_cast<int>(position.y / 60);
 			if (isWalkable(tileX, tileY))
 			{
-				createSoldier(renderer, position, soldier_health, soldier_damage);
+				commands.spawn([=]() { createSoldier(renderer, position, soldier_health, soldier_damage); });
 			}
 		}
 
@@ -542,7 +582,7 @@ void AISystem::process_king_attack(float elapsed_ms)
 		}
 		else if (king.attack_time_elapsed >= 4000.f)
 		{
-			if ((unsigned int)king.laser_entity != 0)
+			if (king.laser_entity.is_alive())
 			{
 				registry.remove_all_components_of(king.laser_entity);
 				king.laser_entity = Entity(0);
@@ -571,14 +611,10 @@ void AISystem::process_king_attack(float elapsed_ms)
 				{
 					vec2 laser_start = king_motion.position + king_motion.bb_offset;
 					float laser_length = laser_motion.bb_scale.x;
-					vec2 laser_end = {laser_start.x + cos(angle) * laser_length, laser_start.y + sin(angle) * laser_length};
 
-					Motion &player_motion = registry.motions.get(registry.players.entities[0]);
-					vec2 player_position = player_motion.position + player_motion.bb_offset;
-					vec2 player_bb = player_motion.bb_scale / 2.f;
-
-					// check laser line intersection with the two diagonals of the player bounding box
-					if (line_intersects(laser_start, laser_end, player_position - player_bb, player_position + player_bb) || line_intersects(laser_start, laser_end, player_position + vec2(-player_bb.x, player_bb.y), player_position + vec2(player_bb.x, -player_bb.y)))
+					// the laser is drawn across walls, so it only looks for the player
+					RaycastHit hit;
+					if (physics->raycast(laser_start, {cos(angle), sin(angle)}, laser_length, layer_bit(CollisionLayer::PLAYER), hit))
 					{
 						Player &player = registry.players.get(registry.players.entities[0]);
 						if (player.can_take_damage())
@@ -618,7 +654,7 @@ void AISystem::process_king_attack(float elapsed_ms)
 
 			vec2 direction = normalize(player_position - king_position);
 			float dash_speed = 500.f;
-			king_motion.velocity = direction * dash_speed;
+			set_velocity(king_entity, direction * dash_speed);
 		}
 		else if (!king.has_fired && king.attack_time_elapsed >= 2000.f * (float)king.dash_counter - 1000.f)
 		{
@@ -681,7 +717,7 @@ void AISystem::process_king_attack(float elapsed_ms)
 		}
 		if (king.attack_time_elapsed >= 3000.f)
 		{
-			if ((unsigned int)king.fire_rain_entity != 0)
+			if (king.fire_rain_entity.is_alive())
 			{
 				registry.remove_all_components_of(king.fire_rain_entity);
 				king.fire_rain_entity = Entity(0);
@@ -724,7 +760,7 @@ void AISystem::process_king_attack(float elapsed_ms)
 
 			vec2 direction = normalize(player_position - king_position);
 			float dash_speed = 500.f;
-			king_motion.velocity = direction * dash_speed;
+			set_velocity(king_entity, direction * dash_speed);
 
 			king.damage_field_created = true;
 			createDamageArea(king_entity, king_position, king_motion.bb_scale * 1.8f, 10.f, 1000.f, 0.f, true, king_motion.bb_offset);
@@ -742,9 +778,10 @@ void AISystem::process_king_attack(float elapsed_ms)
 			vec2 player_position = player_motion.position + player_motion.bb_offset;
 			float teleport_target_side = player_motion.position.x > king_motion.position.x ? 1.f : -1.f;
 			king_motion.position = player_position + vec2(teleport_target_side * (abs(king_motion.bb_scale.x) * 0.5f + 50.f), 0.f) - king_motion.bb_offset;
+			renderer->snap_previous_tick(king_entity);
 
 			// destroy remnant
-			if ((unsigned int)king.remnant_entity != 0)
+			if (king.remnant_entity.is_alive())
 			{
 				registry.remove_all_components_of(king.remnant_entity);
 			}
@@ -979,7 +1016,7 @@ DecisionNode *AISystem::create_knight_decision_tree()
 				Motion &motion = registry.motions.get(entity);
 				if (motion.velocity.x == 0)
 				{
-					motion.velocity.x = 50.f; // Set initial patrol speed
+					set_velocity(entity, {50.f, motion.velocity.y}); // Set initial patrol speed
 				}
 				else
 				{
@@ -1231,9 +1268,10 @@ AISystem::~AISystem()
 	delete king_decision_tree;
 }
 
-void AISystem::init(RenderSystem *renderer)
+void AISystem::init(RenderSystem *renderer, PhysicsSystem *physics)
 {
 	this->renderer = renderer;
+	this->physics = physics;
 }
 
 void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
@@ -1245,12 +1283,11 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
 	if (player_comp.state == PlayerState::DYING || player_comp.stealth_mode)
 	{
 		// skip all ai processing if player is dead (or in stealth mode); also make enemies stop moving/attacking
-		ComponentContainer<Enemy> &enemies = registry.enemies;
-		for (uint i = 0; i < enemies.components.size(); i++)
+		auto enemies = registry.view<Enemy, Motion>();
+		for (Entity entity : enemies)
 		{
-			Enemy &enemy = enemies.components[i];
-			Entity entity = enemies.entities[i];
-			Motion &motion = registry.motions.get(entity);
+			Enemy &enemy = enemies.get<Enemy>(entity);
+			Motion &motion = enemies.get<Motion>(entity);
 			motion.velocity = {0.f, 0.f};
 			if (registry.spriteAnimations.has(entity))
 			{
@@ -1267,18 +1304,16 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
 
 	Motion &player_motion = registry.motions.get(player);
 	vec2 player_position = player_motion.position + player_motion.bb_offset;
-	ComponentContainer<Enemy> &enemies = registry.enemies;
-	for (uint i = 0; i < enemies.components.size(); i++)
+	auto minions = registry.view<Enemy, Motion>(exclude<Chef, Knight, Prince, King>); // Skip all bosses
+	for (Entity entity : minions)
 	{
-		Enemy &enemy = enemies.components[i];
-		Entity entity = enemies.entities[i];
-
-		if (registry.chef.has(entity) || registry.knight.has(entity) || registry.prince.has(entity) || registry.king.has(entity)) // Skip all bosses
+		Enemy &enemy = minions.get<Enemy>(entity);
+		// idle minions are woken up below once the player comes close
+		if (enemy.state == EnemyState::IDLE)
 		{
 			continue;
 		}
-
-		Motion &motion = registry.motions.get(entity);
+		Motion &motion = minions.get<Motion>(entity);
 		vec2 enemy_position = motion.position + motion.bb_offset;
 
 		vec2 adjusted_position = enemy_position;
@@ -1295,28 +1330,20 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
         {
             RangedMinion& rangedMinion = registry.rangedminions.get(entity);
 
-            if (enemy.state == EnemyState::IDLE)
-            {
-                if (distance_to_player < detection_radius_squared)
-                {
-                    enemy.state = EnemyState::COMBAT;
-                    std::cout << "Ranged Enemy " << i << " enters combat" << std::endl;
-                }
-            }
-            else if (enemy.state == EnemyState::COMBAT)
+            if (enemy.state == EnemyState::COMBAT)
             {
                 if (distance_to_player > detection_radius_squared * 2)
                 {
                     enemy.state = EnemyState::IDLE;
                     motion.velocity = {0.f, 0.f};
-                    std::cout << "Ranged Enemy " << i << " enters idle" << std::endl;
+                    std::cout << "Ranged Enemy " << entity << " enters idle" << std::endl;
                 }
                 else if (distance_to_player > rangedMinion.attack_radius_squared)
                 {
                     // Move towards player
                     vec2 direction = player_position - enemy_position;
                     direction = normalize(direction);
-                    motion.velocity = direction * rangedMinion.movement_speed;
+                    set_velocity(entity, direction * rangedMinion.movement_speed);
 
                     // Face the player
                     motion.scale.x = (direction.x < 0) ? abs(motion.scale.x) : -abs(motion.scale.x);
@@ -1332,11 +1359,12 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
 
                     // Attack cooldown
                     enemy.time_since_last_attack += elapsed_ms;
-                    if (enemy.time_since_last_attack > rangedMinion.attack_cooldown)
+                    // only shoot if the arrow is not stopped by a wall on its way
+                    if (enemy.time_since_last_attack > rangedMinion.attack_cooldown && physics->line_of_sight(enemy_position, player_position))
                     {
                         // Shoot arrow
                         vec2 arrow_velocity = normalize(player_position - enemy_position) * rangedMinion.arrow_speed;
-                        createArrow(renderer, enemy_position, arrow_velocity);
+                        commands.spawn([=]() { createArrow(renderer, enemy_position, arrow_velocity); });
 
                         enemy.time_since_last_attack = 0.f;
 
@@ -1360,21 +1388,13 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
         }
         else if (!registry.rangedminions.has(entity))
 		{
-		if (enemy.state == EnemyState::IDLE)
-		{
-			if (distance_to_player < detection_radius_squared)
-			{
-				enemy.state = EnemyState::COMBAT;
-				std::cout << "Enemy " << i << " enters combat" << std::endl;
-			}
-		}
-		else if (enemy.state == EnemyState::COMBAT)
+		if (enemy.state == EnemyState::COMBAT)
 		{
 			if (distance_to_player > detection_radius_squared * 2)
 			{
 				enemy.state = EnemyState::IDLE;
 				motion.velocity = {0.f, 0.f};
-				std::cout << "Enemy " << i << " returns to idle" << std::endl;
+				std::cout << "Enemy " << entity << " returns to idle" << std::endl;
 			}
 			else
 			{
@@ -1390,41 +1410,60 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
 				// }
 				// return;
 
-				std::vector<vec2> path = findPathAStar(adjusted_position, player_position);
-
-				if (debugging.in_debug_mode)
+				vec2 half_size = get_bounding_box(motion) / 2.f;
+				if (isLineWalkable(enemy_position, player_position, half_size))
 				{
-					for (int i = 0; i < path.size(); i++)
-					{
-						vec2 path_point = path[i];
-						createLine(path_point, {10.f, 10.f}, {1.f, 0.f, 0.f}, 0.f);
-					}
+					// nothing in the way, no path needed
+					if (distance_to_player > 1.f)
+						set_velocity(entity, normalize(player_position - enemy_position) * MINION_SPEED);
+					else
+						motion.velocity = {0.f, 0.f};
 				}
-
-				if (path.size() >= 1)
+				else
 				{
-					// stagger update last_tile_position only when enemy is fully on the next tile
-					if (glm::length(enemy_position - enemy.last_tile_position) > TILE_SCALE)
+					// the field is rebuilt after the loop, only once the player got away from its goal
+					player_flow_field.request(player_position, PATH_REPLAN_DISTANCE);
+
+					if (debugging.in_debug_mode)
 					{
-						// std::cout << "LAST TILE POS UPDATED" << std::endl;
-						enemy.last_tile_position = path[0];
+						std::vector<vec2> &path = debug_path;
+						path.clear();
+						player_flow_field.path(adjusted_position, path);
+						for (size_t i = 0; i < path.size(); i++)
+						{
+							vec2 path_point = path[i];
+							createLine(path_point, {10.f, 10.f}, {1.f, 0.f, 0.f}, 0.f);
+						}
 					}
-				}
 
-				if (path.size() >= 2)
-				{
-					// Move towards the next point in the path
-					vec2 target_position = path[1]; // The next node in the path
-					vec2 direction = normalize(target_position - enemy_position);
-					motion.velocity = direction * MINION_SPEED;
-					// std::cout << "enemy_position: " << enemy_position.x << ", " << enemy_position.y << "; adjusted_position: " << adjusted_position.x << ", " << adjusted_position.y << "; direction: " << direction.x << ", " << direction.y << std::endl;
+					if (player_flow_field.reachable(adjusted_position))
+					{
+						// stagger update last_tile_position only when enemy is fully on the next tile
+						if (glm::length(enemy_position - enemy.last_tile_position) > TILE_SCALE)
+						{
+							// std::cout << "LAST TILE POS UPDATED" << std::endl;
+							enemy.last_tile_position = (floor(adjusted_position / TILE_SCALE) + 0.5f) * TILE_SCALE;
+						}
+					}
 
-					enemy.path = path;
-				}
-				else
-				{
-					// No path found or already at the goal
-					motion.velocity = {0.f, 0.f};
+					// head for the farthest of the next few tiles that can be reached in a straight line,
+					// instead of zig-zagging from tile center to tile center
+					path_lookahead.clear();
+					player_flow_field.path(adjusted_position, path_lookahead, PATH_LOOKAHEAD_TILES + 1);
+					if (path_lookahead.size() >= 2)
+					{
+						// from where the minion is rather than the center of its tile
+						path_lookahead[0] = enemy_position;
+						smoothPath(path_lookahead, half_size);
+						vec2 direction = normalize(path_lookahead[1] - enemy_position);
+						set_velocity(entity, direction * MINION_SPEED);
+						// std::cout << "enemy_position: " << enemy_position.x << ", " << enemy_position.y << "; adjusted_position: " << adjusted_position.x << ", " << adjusted_position.y << "; direction: " << direction.x << ", " << direction.y << std::endl;
+					}
+					else
+					{
+						// No path found or already at the goal
+						motion.velocity = {0.f, 0.f};
+					}
 				}
 
 				if (distance_to_player <= attack_radius_squared)
@@ -1442,7 +1481,8 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
 
 						enemy.time_since_last_attack = 0.f;
 
-						createDamageArea(entity, motion.position, {100.f, 70.f}, 7.f, 500.f, 0.f, true, {50.f, 50.f});
+						vec2 damage_area_position = motion.position; // copy, the lambda runs at the end of the frame
+						commands.spawn([=]() { createDamageArea(entity, damage_area_position, {100.f, 70.f}, 7.f, 500.f, 0.f, true, {50.f, 50.f}); });
 					}
 				}
 			}
@@ -1457,7 +1497,7 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
 			if (enemy.attack_countdown <= 0)
 			{
 				enemy.state = EnemyState::COMBAT;
-				// printf("Enemy %d finish attack\n", i);
+				// printf("Enemy %u finish attack\n", (unsigned int)entity);
 				enemy.attack_countdown = 500;
 				if (registry.spriteAnimations.has(entity))
 				{
@@ -1478,6 +1518,27 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
 		}
 	}
 
+	player_flow_field.service(level_grid, PATH_BUDGET_US);
+
+	// Wake up the idle minions within the detection radius, they start fighting in the next step
+	// the index holds their positions, their boxes are offset from them by less than a tile
+	nearby_enemies.clear();
+	spatial_index.query_radius(player_position, sqrt(detection_radius_squared) + TILE_SCALE, nearby_enemies);
+	for (Entity entity : nearby_enemies)
+	{
+		if (!minions.contains(entity))
+		{
+			continue;
+		}
+		Enemy &enemy = minions.get<Enemy>(entity);
+		Motion &motion = minions.get<Motion>(entity);
+		if (enemy.state == EnemyState::IDLE && distance_squared(player_position, motion.position + motion.bb_offset) < detection_radius_squared)
+		{
+			enemy.state = EnemyState::COMBAT;
+			std::cout << (registry.rangedminions.has(entity) ? "Ranged Enemy " : "Enemy ") << entity << " enters combat" << std::endl;
+		}
+	}
+
 
 	if (registry.chef.size() > 0)
 	{
@@ -1535,7 +1596,7 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
 				{
 					// Dash to player (no damage)
 					vec2 direction = normalize(player_position - knight_position);
-					knight_motion.velocity = direction * 300.f;
+					set_velocity(knight_entity, direction * 300.f);
 					knight.time_since_last_attack = 0.f;
 					knight.dash_has_ended = false;
 
@@ -1626,7 +1687,7 @@ void AISystem::step(float elapsed_ms, std::vector<std::vector<int>> &levelMap)
 					knight.dash_has_started = true;
 
 					vec2 direction = normalize(player_position - knight_position);
-					knight_motion.velocity = direction * 400.f;
+					set_velocity(knight_entity, direction * 400.f);
 					createDamageArea(knight_entity, knight_position, knight_motion.bb_scale * 1.8f, 15.f, 1000.f, 0.f, true, knight_motion.bb_offset);
 				}
 			}
@@ -1732,139 +1793,17 @@ void AISystem::boss_attack(Entity entity, int attack_id, float elapsed_ms)
 	}
 }
 
-float heuristic(int x1, int y1, int x2, int y2)
+void AISystem::smoothPath(std::vector<vec2> &path, vec2 half_size)
 {
-	return static_cast<float>(std::abs(x1 - x2) + std::abs(y1 - y2)); // Manhattan distance
-}
-
-int nodeKey(int x, int y, int maxHeight)
-{
-	return x * maxHeight + y;
-}
-
-std::vector<vec2> AISystem::findPathAStar(vec2 startPos, vec2 goalPos)
-{
-	const int TILE_SIZE = 60;
-	int startX = static_cast<int>(startPos.x / TILE_SIZE);
-	int startY = static_cast<int>(startPos.y / TILE_SIZE);
-	int goalX = static_cast<int>(goalPos.x / TILE_SIZE);
-	int goalY = static_cast<int>(goalPos.y / TILE_SIZE);
-
-	// std::cout << "===========================" << std::endl;
-
-	// for (int dy = -2; dy <= 2; dy++)
-	// {
-	// 	for (int dx = -2; dx <= 2; dx++)
-	// 	{
-	// 		std::cout << isWalkable(goalX + dx, goalY + dy) << " ";
-	// 	}
-	// 	std::cout << std::endl;
-	// }
-	// std::cout << "===========================" << std::endl;
-
-	int maxHeight = level_grid[0].size();
-
-	// Comparator for priority queue
-	struct CompareAStarNode
-	{
-		bool operator()(AStarNode *a, AStarNode *b)
-		{
-			return a->fCost > b->fCost;
-		}
-	};
-
-	std::priority_queue<AStarNode *, std::vector<AStarNode *>, CompareAStarNode> openSet;
-	std::unordered_map<int, AStarNode *> allNodes;
-
-	int key = nodeKey(startX, startY, maxHeight);
-	AStarNode *startNode = new AStarNode{startX, startY, 0, heuristic(startX, startY, goalX, goalY), 0, nullptr};
-	startNode->fCost = startNode->gCost + startNode->hCost;
-	openSet.push(startNode);
-	allNodes[key] = startNode;
-
-	std::vector<std::pair<int, int>> directions = {
-			{0, -1},	// Up
-			{1, 0},		// Right
-			{0, 1},		// Down
-			{-1, 0},	// Left
-			{-1, -1}, // Up-Left
-			{1, -1},	// Up-Right
-			{1, 1},		// Down-Right
-			{-1, 1}		// Down-Left
-	};
-
-	while (!openSet.empty())
-	{
-		// Get the node with the lowest fCost
-		AStarNode *current = openSet.top();
-		openSet.pop();
-
-		// If we've reached the goal, reconstruct and return the path
-		if (current->x == goalX && current->y == goalY)
-		{
-			// Reconstruct path
-			std::vector<vec2> path;
-			AStarNode *node = current;
-			while (node != nullptr)
-			{
-				path.push_back(vec2{node->x * TILE_SIZE + TILE_SIZE / 2.0f,
-														node->y * TILE_SIZE + TILE_SIZE / 2.0f});
-				node = node->parent;
-			}
-			std::reverse(path.begin(), path.end());
-
-			// Clean up all dynamically allocated nodes
-			for (auto &pair : allNodes)
-			{
-				delete pair.second;
-			}
-			return path;
-		}
-
-		// Explore all valid neighbors of the current node
-		for (const auto &dir : directions)
-		{
-			int nx = current->x + dir.first;	// Neighbor x-coordinate
-			int ny = current->y + dir.second; // Neighbor y-coordinate
-
-			if (dir.first != 0 && dir.second != 0)
-			{ // Diagonal movement
-				if (!isWalkable(current->x + dir.first, current->y) ||
-						!isWalkable(current->x, current->y + dir.second))
-				{
-					continue;
-				}
-			}
-
-			if (isWalkable(nx, ny))
-			{
-				int neighborKey = nodeKey(nx, ny, maxHeight); // Generate unique key for the neighbor
-				// float gCost = current->gCost + ((dir.first != 0 && dir.second != 0) ? 1.4f : 1.0f); // Diagonal cost is ~?2 (1.4)
-				float baseCost = (dir.first != 0 && dir.second != 0) ? 1.4f : 1.0f;
-				float gCost = current->gCost + baseCost;
-				float hCost = heuristic(nx, ny, goalX, goalY); // Calculate heuristic cost (Manhattan distance)
-				float fCost = gCost + hCost;									 // Total cost = gCost + hCost
-
-				if (allNodes.find(neighborKey) == allNodes.end() || gCost < allNodes[neighborKey]->gCost)
-				{
-					// Create or update the neighbor node
-					AStarNode *neighbor = new AStarNode{nx, ny, gCost, hCost, fCost, current};
-					openSet.push(neighbor);						// Add to the open set
-					allNodes[neighborKey] = neighbor; // Update the allNodes map
-				}
-			}
-		}
-	}
-
-	// No path found; clean up dynamically allocated nodes
-	for (auto &pair : allNodes)
+	if (path.size() <= 2)
+		return;
+	// string pulling: a point is kept only if the one after it cannot be reached in a straight line from the last kept one
+	size_t kept = 0;
+	for (size_t i = 1; i + 1 < path.size(); i++)
 	{
-		delete pair.second;
+		if (!isLineWalkable(path[kept], path[i + 1], half_size))
+			path[++kept] = path[i];
 	}
-
-	return {};
+	path[++kept] = path.back();
+	path.resize(kept + 1);
 }
-
-// sources for A*:
-// https://www.youtube.com/watch?v=-L-WgKMFuhE
-// https://www.youtube.com/watch?v=NJOf_MYGrYs&t=876s
@@ -5,6 +5,7 @@
 #include "tiny_ecs_registry.hpp"
 #include "common.hpp"
 #include "render_system.hpp"
+#include "physics_system.hpp"
 
 #define SDL_MAIN_HANDLED
 #include <SDL.h>
@@ -57,7 +58,7 @@ class AISystem
 public:
     AISystem();
     ~AISystem();
-    void init(RenderSystem *renderer);
+    void init(RenderSystem *renderer, PhysicsSystem *physics);
     void step(float elapsed_ms, std::vector<std::vector<int>> &levelMap);
     void boss_attack(Entity entity, int attack_id, float elapsed_ms);
     // struct Node
@@ -73,10 +74,18 @@ public:
     // 	}
     // };
 
-    std::vector<vec2> findPathAStar(vec2 start, vec2 goal);
+    // Drops the points of a path that a box of half_size can walk past in a straight line
+    void smoothPath(std::vector<vec2> &path, vec2 half_size);
 
 private:
     RenderSystem *renderer;
+    // for line of sight and laser hits
+    PhysicsSystem *physics;
+    // enemies found by the spatial index, reused every step
+    std::vector<Entity> nearby_enemies;
+
+    std::vector<vec2> debug_path; // the flow field path drawn in debug mode
+    std::vector<vec2> path_lookahead;
 
     DecisionNode *chef_decision_tree;
     DecisionNode *knight_decision_tree;
@@ -99,15 +108,3 @@ private:
     // bool isWalkable(int x, int y, const std::vector<std::vector<int>>& grid);
     // std::vector<Node> findPathBFS(int startX, int startY, int targetX, int targetY, const std::vector<std::vector<int>>& grid);
 };
-
-struct AStarNode
-{
-    int x, y;
-    float gCost, hCost, fCost;
-    AStarNode *parent;
-
-    bool operator>(const AStarNode &other) const
-    {
-        return fCost > other.fCost;
-    }
-};
\ No newline at end of file
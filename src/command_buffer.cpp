@@ -0,0 +1,32 @@
+// internal
+#include "command_buffer.hpp"
+
+#include <algorithm>
+
+CommandBuffer commands;
+
+void CommandBuffer::flush()
+{
+	// Commands may record further commands, those are applied in the same flush
+	for (size_t i = 0; i < commands.size(); i++)
+	{
+		std::function<void()> command = std::move(commands[i]);
+		command();
+	}
+	commands.clear();
+
+	// Sort the destroyed entities so that duplicates are removed and the containers are visited in id order
+	std::sort(destroyed.begin(), destroyed.end());
+	destroyed.erase(std::unique(destroyed.begin(), destroyed.end(), [](Entity a, Entity b)
+															{ return (unsigned int)a == (unsigned int)b; }),
+									destroyed.end());
+	for (Entity e : destroyed)
+		registry.remove_all_components_of(e);
+	destroyed.clear();
+}
+
+void CommandBuffer::clear()
+{
+	commands.clear();
+	destroyed.clear();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+
+#include "tiny_ecs.hpp"
+#include "tiny_ecs_registry.hpp"
+
+// Records entity changes while the systems iterate over the registry and applies them in one batch at
+// the end of the frame (see main.cpp), so no container is modified while it is being walked.
+// Commands are applied in the order they were recorded, destroys come last and happen once per entity.
+class CommandBuffer
+{
+	std::vector<std::function<void()>> commands;
+	std::vector<Entity> destroyed;
+
+public:
+	// The new handle can be used right away, components recorded for it are added on flush
+	Entity create()
+	{
+		return Entity();
+	}
+
+	template <typename Component>
+	void emplace(Entity e, Component component)
+	{
+		commands.push_back([e, component]() mutable
+											 { registry.get<Component>().insert(e, std::move(component)); });
+	}
+
+	template <typename Component>
+	void remove(Entity e)
+	{
+		commands.push_back([e]()
+											 { registry.get<Component>().remove(e); });
+	}
+
+	// Removes all components of the entity on flush, see ECSRegistry::remove_all_components_of
+	void destroy(Entity e)
+	{
+		destroyed.push_back(e);
+	}
+
+	// Defers one of the create* functions of world_init, e.g. spawn([=]() { createArrow(renderer, position, velocity); });
+	void spawn(std::function<void()> create_function)
+	{
+		commands.push_back(std::move(create_function));
+	}
+
+	// Applies all recorded commands
+	void flush();
+
+	// Drops all recorded commands, e.g. when the level they were recorded for is unloaded
+	void clear();
+};
+
+extern CommandBuffer commands;
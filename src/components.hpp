@@ -17,6 +17,14 @@ struct Motion
 	vec2 pivot_offset = {0, 0};				// before scaling
 	bool ignore_render_order = false; // if true, always rendered first (will be covered by others)
 	int layer = 0;										// determines render order (before y-position is considered)
+	vec2 previous_position = {0, 0};	// position at the start of the current simulation tick, for render interpolation
+	bool has_previous_position = false; // false until the first tick after the motion was created
+};
+
+// The active set of the physics system: only these motions are integrated each step.
+// Entities join it through set_velocity() and leave it once their velocity is zero.
+struct Moving
+{
 };
 
 // Player component
@@ -108,11 +116,7 @@ struct Enemy
 	float attack_damage = 10.0f;
 	unsigned int last_hit_attack_id = 0;
 	bool is_minion = false;
-	std::vector<vec2> path;
-	size_t current_path_index;
-	int pathfinding_counter;
 	vec2 last_tile_position = {0, 0};
-	// int current_path_index = 0; // Index of the next node to follow
 };
 
 struct SpinArea
@@ -203,6 +207,8 @@ struct Health
 struct HealthBar
 {
 	vec2 original_scale;
+	Entity owner = Entity(0);
+	vec2 offset_from_owner = {0.f, 0.f}; // set every step, the bar is drawn at this offset from the interpolated owner
 };
 
 struct Energy
@@ -229,17 +235,37 @@ enum class BodyType
 	PROJECTILE = KINEMATIC + 1,
 	NONE = PROJECTILE + 1
 };
-struct PhysicsBody
+// What a body is to the gameplay, contacts are handed to the handlers of their pair of layers (see contact_buffer.hpp)
+enum class CollisionLayer
 {
-	BodyType body_type = BodyType::STATIC;
+	DEFAULT = 0,
+	PLAYER = DEFAULT + 1,
+	WEAPON = PLAYER + 1,
+	ENEMY = WEAPON + 1,
+	PROJECTILE = ENEMY + 1,
+	DAMAGE_AREA = PROJECTILE + 1,
+	PAN = DAMAGE_AREA + 1,
+	WALL = PAN + 1, // wall tiles and other static bodies
+	LAYER_COUNT = WALL + 1
 };
+// The bit of a layer in a collision mask
+constexpr unsigned int layer_bit(CollisionLayer layer)
+{
+	return 1u << (unsigned int)layer;
+}
+const unsigned int ALL_LAYERS = ~0u;
 
-// Stucture to store collision information
-struct Collision
+struct PhysicsBody
 {
-	// Note, the first object is stored in the ECS container.entities
-	Entity other; // the second object involved in the collision
-	Collision(Entity &other) { this->other = other; };
+	BodyType body_type = BodyType::STATIC;
+	CollisionLayer layer = CollisionLayer::DEFAULT;
+	// Layers this body collides with; two bodies are only tested against each other if both masks contain the other's layer
+	unsigned int mask = ALL_LAYERS;
+
+	bool accepts(const PhysicsBody &other) const
+	{
+		return (mask & layer_bit(other.layer)) != 0 && (other.mask & layer_bit(layer)) != 0;
+	}
 };
 
 enum class PanState
@@ -315,6 +341,14 @@ struct TexturedMesh
 	std::vector<uint16_t> vertex_indices;
 };
 
+// The triangles of an entity's TexturedMesh in world space, transformed once per physics step for collision tests
+struct MeshCollider
+{
+	std::vector<vec2> corners; // three per triangle
+	vec2 bounds_min = {0, 0};
+	vec2 bounds_max = {0, 0};
+};
+
 struct MeshBone
 {
 	int parent_index = -1;
@@ -0,0 +1,53 @@
+// internal
+#include "contact_buffer.hpp"
+
+#include <algorithm>
+
+ContactBuffer contacts;
+
+void ContactBuffer::add(Entity a, Entity b, vec2 normal, float depth, CollisionLayer layer_a, CollisionLayer layer_b)
+{
+	if (layer_a <= layer_b)
+		contacts.push_back({a, b, normal, depth, layer_a, layer_b});
+	else
+		contacts.push_back({b, a, -normal, depth, layer_b, layer_a});
+}
+
+void ContactBuffer::subscribe(CollisionLayer layer_a, CollisionLayer layer_b, std::function<void(const Contact &)> handler)
+{
+	if (layer_a <= layer_b)
+	{
+		handlers[(int)layer_a][(int)layer_b].push_back(std::move(handler));
+		return;
+	}
+	// the contacts of the pair are stored the other way around, swap them back for the handler
+	handlers[(int)layer_b][(int)layer_a].push_back([handler](const Contact &contact)
+																								 { handler({contact.b, contact.a, -contact.normal, contact.depth, contact.layer_b, contact.layer_a}); });
+}
+
+void ContactBuffer::dispatch()
+{
+	// within a pair the contacts stay in the order the physics system found them
+	std::stable_sort(contacts.begin(), contacts.end(), [](const Contact &c1, const Contact &c2)
+									 { return c1.layer_a < c2.layer_a || (c1.layer_a == c2.layer_a && c1.layer_b < c2.layer_b); });
+	for (const Contact &contact : contacts)
+	{
+		for (auto &handler : handlers[(int)contact.layer_a][(int)contact.layer_b])
+			handler(contact);
+	}
+}
+
+void ContactBuffer::clear()
+{
+	contacts.clear();
+}
+
+bool ContactBuffer::has(Entity e) const
+{
+	for (const Contact &contact : contacts)
+	{
+		if (contact.a == e || contact.b == e)
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+
+#include "common.hpp"
+#include "tiny_ecs.hpp"
+#include "components.hpp"
+
+// A contact between two physics bodies found by the physics system
+struct Contact
+{
+	Entity a;
+	Entity b;			 // Entity(0) for a wall tile
+	vec2 normal;	 // axis of the smallest overlap, pointing from a to b
+	float depth;	 // overlap along the normal
+	CollisionLayer layer_a;
+	CollisionLayer layer_b;
+};
+
+// The contacts of one physics step in a flat array. Gameplay code subscribes a handler to a pair of layers
+// (e.g. weapon x enemy) and every contact is handed once to the handlers of its pair (see WorldSystem::handle_collisions).
+class ContactBuffer
+{
+	std::vector<Contact> contacts;
+	std::vector<std::function<void(const Contact &)>> handlers[(int)CollisionLayer::LAYER_COUNT][(int)CollisionLayer::LAYER_COUNT];
+
+public:
+	// Contacts are stored with the lower layer first
+	void add(Entity a, Entity b, vec2 normal, float depth, CollisionLayer layer_a, CollisionLayer layer_b);
+
+	// The handler is called with contact.a on layer_a and contact.b on layer_b
+	void subscribe(CollisionLayer layer_a, CollisionLayer layer_b, std::function<void(const Contact &)> handler);
+
+	// Sorts the contacts by layer pair and calls the handlers of each pair on its contacts
+	void dispatch();
+
+	// Drops all contacts, once they are handled
+	void clear();
+
+	size_t size() const { return contacts.size(); }
+	const Contact &operator[](size_t i) const { return contacts[i]; }
+
+	// Linear in the number of contacts, for debugging only
+	bool has(Entity e) const;
+};
+
+extern ContactBuffer contacts;
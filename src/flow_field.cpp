@@ -0,0 +1,163 @@
+// internal
+#include "flow_field.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+FlowField player_flow_field;
+
+const int FlowField::UNREACHABLE;
+
+void FlowField::reset(int width, int height)
+{
+	this->width = std::max(width, 0);
+	this->height = std::max(height, 0);
+	goal = -1;
+	building = false;
+	requested = false;
+	distance.assign(this->width * this->height, UNREACHABLE);
+	next.assign(this->width * this->height, -1);
+	build_distance.assign(this->width * this->height, UNREACHABLE);
+	build_next.assign(this->width * this->height, -1);
+	walkable_tiles.assign(this->width * this->height, 0);
+}
+
+int FlowField::tile_of(vec2 position) const
+{
+	int x = (int)floor(position.x / TILE_SCALE);
+	int y = (int)floor(position.y / TILE_SCALE);
+	if (x < 0 || y < 0 || x >= width || y >= height)
+		return -1;
+	return y * width + x;
+}
+
+vec2 FlowField::center_of(int tile) const
+{
+	return {(tile % width) * TILE_SCALE + TILE_SCALE / 2.f, (tile / width) * TILE_SCALE + TILE_SCALE / 2.f};
+}
+
+void FlowField::request(vec2 goal_position, float replan_distance)
+{
+	// compared with the field being built, if there is one, so that a rebuild is not requested twice
+	int target = building ? build_goal : goal;
+	if (target >= 0 ? length(goal_position - center_of(target)) <= replan_distance : tile_of(goal_position) < 0)
+		return;
+	requested = true;
+	requested_goal = goal_position;
+}
+
+void FlowField::start_build(const std::vector<std::vector<int>> &grid, int goal_tile)
+{
+	building = true;
+	build_goal = goal_tile;
+	std::fill(build_distance.begin(), build_distance.end(), UNREACHABLE);
+	std::fill(build_next.begin(), build_next.end(), -1);
+
+	// level_grid is indexed [x][y], copy it into the tile order of the field once instead of per neighbour
+	for (int x = 0; x < width; x++)
+	{
+		for (int y = 0; y < height; y++)
+			walkable_tiles[y * width + x] = x < (int)grid.size() && y < (int)grid[x].size() && grid[x][y] == 1;
+	}
+
+	for (std::vector<int> &bucket : buckets)
+		bucket.clear();
+	bucket_distance = 0;
+	bucket_index = 0;
+	pending = 0;
+	if (goal_tile >= 0 && walkable_tiles[goal_tile])
+	{
+		build_distance[goal_tile] = 0;
+		buckets[0].push_back(goal_tile);
+		pending = 1;
+	}
+}
+
+void FlowField::expand(int tile)
+{
+	static const int directions[8][2] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}, {-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+	auto walkable = [&](int x, int y)
+	{
+		return x >= 0 && y >= 0 && x < width && y < height && walkable_tiles[y * width + x];
+	};
+
+	int x = tile % width;
+	int y = tile / width;
+	for (const auto &dir : directions)
+	{
+		int nx = x + dir[0];
+		int ny = y + dir[1];
+		bool diagonal = dir[0] != 0 && dir[1] != 0;
+		if (diagonal && (!walkable(x + dir[0], y) || !walkable(x, y + dir[1])))
+			continue;
+		if (!walkable(nx, ny))
+			continue;
+		int neighbour = ny * width + nx;
+		int d = bucket_distance + (diagonal ? DIAGONAL_COST : STRAIGHT_COST);
+		if (d < build_distance[neighbour])
+		{
+			// the steps are the same both ways, so the neighbour reaches the goal through this tile
+			build_distance[neighbour] = d;
+			build_next[neighbour] = tile;
+			buckets[d % BUCKET_COUNT].push_back(neighbour);
+			pending++;
+		}
+	}
+}
+
+void FlowField::service(const std::vector<std::vector<int>> &grid, float budget_us)
+{
+	auto start_time = std::chrono::steady_clock::now();
+	if (!building)
+	{
+		if (!requested)
+			return;
+		requested = false;
+		start_build(grid, tile_of(requested_goal));
+	}
+
+	// Dijkstra outward from the goal. With only two step costs the open tiles fit in one bucket per distance,
+	// and no tile is ever more than DIAGONAL_COST ahead of the bucket being emptied, so the buckets are reused in a ring.
+	// A tile can be in a bucket more than once, stale entries are skipped.
+	int expanded = 0;
+	while (pending > 0)
+	{
+		std::vector<int> &bucket = buckets[bucket_distance % BUCKET_COUNT];
+		while (bucket_index < bucket.size())
+		{
+			int tile = bucket[bucket_index++];
+			if (build_distance[tile] != bucket_distance)
+				continue;
+			expand(tile);
+			// looking at the clock costs more than expanding a tile, so only every few tiles
+			if (++expanded % 32 == 0 &&
+					std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start_time).count() > budget_us)
+				return;
+		}
+		pending -= (int)bucket.size();
+		bucket.clear();
+		bucket_index = 0;
+		bucket_distance++;
+	}
+
+	// the new field is complete, the minions follow it from now on
+	std::swap(distance, build_distance);
+	std::swap(next, build_next);
+	goal = build_goal;
+	building = false;
+}
+
+bool FlowField::reachable(vec2 position) const
+{
+	int tile = tile_of(position);
+	return tile >= 0 && distance[tile] != UNREACHABLE;
+}
+
+void FlowField::path(vec2 position, std::vector<vec2> &result, size_t max_points) const
+{
+	int tile = tile_of(position);
+	if (tile < 0 || (tile != goal && next[tile] < 0))
+		return;
+	for (size_t count = 0; tile >= 0 && count < max_points; tile = next[tile], count++)
+		result.push_back(center_of(tile));
+}
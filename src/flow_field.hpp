@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "common.hpp"
+
+// Distance to the player's tile from every walkable tile of level_grid, with the neighbour to step to next.
+// All melee minions chase the same goal, so instead of a path search per minion the field is built once with
+// Dijkstra from the goal tile, and each minion reads its next tile in O(1).
+// Steps go in 8 directions, diagonals cost 1.4 and may not cut wall corners.
+//
+// A rebuild is requested by the minions once the player got too far from the goal of the field, and is spread over
+// several AI steps by service(); until it is finished the minions keep following the previous field.
+class FlowField
+{
+public:
+	// Forgets the field, the level has width x height tiles
+	void reset(int width, int height);
+	// Asks for a field toward goal if goal is more than replan_distance away from the center of the current goal tile
+	void request(vec2 goal, float replan_distance);
+	// Works on the requested field for about budget_us microseconds
+	void service(const std::vector<std::vector<int>> &grid, float budget_us);
+	bool is_building() const { return building; }
+
+	bool reachable(vec2 position) const;
+	// Appends the tile centers from the tile of position toward the goal, at most max_points of them
+	void path(vec2 position, std::vector<vec2> &result, size_t max_points = SIZE_MAX) const;
+
+private:
+	// step costs in tenths of a tile
+	static const int STRAIGHT_COST = 10;
+	static const int DIAGONAL_COST = 14;
+	static const int BUCKET_COUNT = DIAGONAL_COST + 1;
+	static const int UNREACHABLE = 0x7fffffff;
+
+	int width = 0;
+	int height = 0;
+	int goal = -1; // tile the field was built for, -1 if there is none
+	std::vector<int> distance; // per tile y * width + x
+	std::vector<int> next;			 // neighbour on a shortest way to the goal, -1 for the goal and unreachable tiles
+
+	bool requested = false;
+	vec2 requested_goal = {0.f, 0.f};
+
+	// the field being built, swapped with the one above once it is finished
+	bool building = false;
+	int build_goal = -1;
+	std::vector<int> build_distance;
+	std::vector<int> build_next;
+	std::vector<unsigned char> walkable_tiles;
+	std::vector<int> buckets[BUCKET_COUNT]; // open tiles by distance, modulo BUCKET_COUNT
+	int pending = 0;										 // entries in all buckets
+	int bucket_distance = 0;						 // the bucket being emptied and the next entry in it
+	size_t bucket_index = 0;
+
+	int tile_of(vec2 position) const;
+	vec2 center_of(int tile) const;
+	void start_build(const std::vector<std::vector<int>> &grid, int goal_tile);
+	void expand(int tile);
+};
+
+extern FlowField player_flow_field;
@@ -10,9 +10,15 @@
 #include "render_system.hpp"
 #include "world_system.hpp"
 #include "ai_system.hpp"
+#include "command_buffer.hpp"
 
 using Clock = std::chrono::high_resolution_clock;
 
+// The simulation advances in fixed ticks of this length, independent of the frame rate
+const float TICK_MS = 1000.f / 60.f;
+// At most this many ticks are run per rendered frame; after a long hitch the game slows down instead of catching up
+const int MAX_TICKS_PER_FRAME = 5;
+
 // Entry point
 int main()
 {
@@ -34,11 +40,12 @@ int main()
 
 	// initialize the main systems
 	renderer.init(window);
-	world.init(&renderer);
-	ai.init(&renderer);
+	world.init(&renderer, &physics);
+	ai.init(&renderer, &physics);
 
-	// variable timestep loop
+	// fixed timestep loop, rendering interpolates between the last two ticks
 	auto t = Clock::now();
+	float accumulator_ms = 0.f;
 	while (!world.is_over())
 	{
 		// Processes system messages, if this wasn't present the window would become unresponsive
@@ -49,13 +56,29 @@ int main()
 		float elapsed_ms =
 				(float)(std::chrono::duration_cast<std::chrono::microseconds>(now - t)).count() / 1000;
 		t = now;
+		world.update_fps(elapsed_ms, physics);
 
 		if (!world.is_paused)
 		{
-			world.step(elapsed_ms);
-			ai.step(elapsed_ms, world.levelMap);
-			physics.step(elapsed_ms);
-			world.handle_collisions();
+			accumulator_ms += elapsed_ms;
+			int ticks = 0;
+			while (accumulator_ms >= TICK_MS && ticks < MAX_TICKS_PER_FRAME)
+			{
+				renderer.save_previous_tick();
+				world.step(TICK_MS);
+				ai.step(TICK_MS, world.levelMap);
+				physics.step(TICK_MS);
+				world.handle_collisions();
+
+				// apply the entity changes the systems recorded during this tick
+				commands.flush();
+
+				accumulator_ms -= TICK_MS;
+				ticks++;
+			}
+			// the time that could not be simulated in this frame is dropped
+			accumulator_ms = min(accumulator_ms, TICK_MS);
+			renderer.interpolation_alpha = accumulator_ms / TICK_MS;
 		}
 
 		renderer.draw();
@@ -1,8 +1,28 @@
 // internal
 #include "physics_system.hpp"
 #include "world_init.hpp"
+#include "command_buffer.hpp"
+#include "tilemap_collider.hpp"
+#include "contact_buffer.hpp"
+#include "spatial_index.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <limits>
+
+// How far a moving body may be pushed by collision resolution within one step and still be found by the broad phase
+const float BROAD_PHASE_MARGIN = TILE_SCALE / 2.f;
+
+// How far a fast body is moved past its first contact, so that the narrow phase reports the collision
+const float CONTACT_SKIN = 0.01f;
+
+// Relaxation passes over all solid contacts per step, and the overlap below which the solver stops early
+const int SOLVER_ITERATIONS = 4;
+const float SOLVER_TOLERANCE = 0.01f;
+
+// walkability of every tile, defined in world_system.cpp; its size is the size of the broad phase grid
+extern std::vector<std::vector<int>> level_grid;
 
 // Returns the local bounding coordinates scaled by the current size of the entity
 vec2 get_bounding_box(const Motion &motion)
@@ -25,109 +45,262 @@ bool collides(const Motion &motion1, const Motion &motion2)
 	return pos1.x + bb1.x >= pos2.x && pos2.x + bb2.x >= pos1.x && pos1.y + bb1.y >= pos2.y && pos2.y + bb2.y >= pos1.y;
 }
 
-bool is_point_in_box(const vec2 &p, const vec2 &box_pos, const vec2 &box_bb)
+// Axis of the smallest overlap of the two boxes, pointing from the first to the second; the bodies are separated along it
+// For boxes that do not overlap it is the axis they are furthest apart on, and depth is negative
+vec2 contact_normal(const Motion &motion1, const Motion &motion2, float &depth)
 {
-	return p.x >= box_pos.x && p.x <= box_pos.x + box_bb.x && p.y >= box_pos.y && p.y <= box_pos.y + box_bb.y;
+	vec2 bb1 = get_bounding_box(motion1);
+	vec2 bb2 = get_bounding_box(motion2);
+	vec2 pos1 = motion1.position + motion1.bb_offset - bb1 / 2.f;
+	vec2 pos2 = motion2.position + motion2.bb_offset - bb2 / 2.f;
+	float overlap_x = min(pos1.x + bb1.x - pos2.x, pos2.x + bb2.x - pos1.x);
+	float overlap_y = min(pos1.y + bb1.y - pos2.y, pos2.y + bb2.y - pos1.y);
+	if (overlap_x < overlap_y)
+	{
+		depth = overlap_x;
+		return {pos1.x < pos2.x ? 1.f : -1.f, 0.f};
+	}
+	depth = overlap_y;
+	return {0.f, pos1.y < pos2.y ? 1.f : -1.f};
 }
 
-// computes the cross product of two vectors
-float cross(const vec2 &a, const vec2 &b)
+// Bodies that are pushed out of each other; projectiles and None bodies only report their contacts
+bool is_solid(BodyType body_type)
 {
-	return a.x * b.y - a.y * b.x;
+	return body_type == BodyType::STATIC || body_type == BodyType::KINEMATIC;
 }
 
-bool line_intersects(const vec2 &a1, const vec2 &a2, const vec2 &b1, const vec2 &b2)
+// Static bodies are never pushed, all kinematic bodies weigh the same
+float inverse_mass(BodyType body_type)
 {
-	// checks if the line segment (a1, a2) intersects with (b1, b2)
-	// inspired by https://stackoverflow.com/questions/563198/how-do-you-detect-where-two-line-segments-intersect
-	vec2 p = a1;
-	vec2 r = a2 - a1;
-	vec2 q = b1;
-	vec2 s = b2 - b1;
-	float rxs = cross(r, s);
-	float qpxr = cross(q - p, r);
-	if (rxs == 0)
-	{
-		if (qpxr == 0)
-		{
-			// colinear
-			float t0 = glm::dot(q - p, r) / glm::dot(r, r);
-			float t1 = t0 + glm::dot(s, r) / glm::dot(r, r);
-			// intersects if [t0, t1] intersects [0, 1]
-			return !(min(t0, t1) > 1 || max(t0, t1) < 0);
-		}
-		// parallel
-		return false;
+	return body_type == BodyType::KINEMATIC ? 1.f : 0.f;
+}
+
+// Slab test of a ray against a box. t is the distance at which the ray enters the box, 0 if it starts inside,
+// and normal the side it enters through
+bool ray_hits_box(vec2 origin, vec2 direction, vec2 box_min, vec2 box_max, float &t, vec2 &normal)
+{
+	float t_enter = 0.f;
+	float t_exit = std::numeric_limits<float>::infinity();
+	normal = {0.f, 0.f};
+	for (int axis = 0; axis < 2; axis++)
+	{
+		if (direction[axis] == 0.f)
+		{
+			if (origin[axis] < box_min[axis] || origin[axis] > box_max[axis])
+			{
+				return false;
+			}
+			continue;
+		}
+		float t0 = (box_min[axis] - origin[axis]) / direction[axis];
+		float t1 = (box_max[axis] - origin[axis]) / direction[axis];
+		float side = -1.f;
+		if (t0 > t1)
+		{
+			std::swap(t0, t1);
+			side = 1.f;
+		}
+		if (t0 > t_enter)
+		{
+			t_enter = t0;
+			normal = {0.f, 0.f};
+			normal[axis] = side;
+		}
+		t_exit = min(t_exit, t1);
+		if (t_enter > t_exit)
+		{
+			return false;
+		}
 	}
-	float t = cross(q - p, s) / rxs;
-	float u = cross(q - p, r) / rxs;
-	return t >= 0 && t <= 1 && u >= 0 && u <= 1;
+	t = t_enter;
+	return true;
 }
 
-bool mesh_collides(Entity mesh_entity, const Motion &mesh_motion, const Motion &box_motion)
+// Grid DDA: visits the TILE_SCALE cells crossed by the ray in order, with the distance at which the ray enters each,
+// until visit returns false or the ray is longer than max_distance; direction has to be normalized
+template <typename Visit>
+void walk_cells(vec2 origin, vec2 direction, float max_distance, Visit visit)
 {
-	// ONLY WEAPON MESH is supported
-	if (!registry.texturedMeshPtrs.has(mesh_entity))
+	const float infinity = std::numeric_limits<float>::infinity();
+	int x = (int)floor(origin.x / TILE_SCALE);
+	int y = (int)floor(origin.y / TILE_SCALE);
+	int step_x = direction.x > 0.f ? 1 : -1;
+	int step_y = direction.y > 0.f ? 1 : -1;
+	// distance to the next vertical and horizontal cell border, and between two such borders
+	float next_x = direction.x != 0.f ? ((x + (step_x > 0 ? 1 : 0)) * TILE_SCALE - origin.x) / direction.x : infinity;
+	float next_y = direction.y != 0.f ? ((y + (step_y > 0 ? 1 : 0)) * TILE_SCALE - origin.y) / direction.y : infinity;
+	float delta_x = direction.x != 0.f ? TILE_SCALE / abs(direction.x) : infinity;
+	float delta_y = direction.y != 0.f ? TILE_SCALE / abs(direction.y) : infinity;
+	float t = 0.f;
+	while (t <= max_distance)
+	{
+		if (!visit(x, y, t))
+		{
+			return;
+		}
+		if (next_x < next_y)
+		{
+			t = next_x;
+			next_x += delta_x;
+			x += step_x;
+		}
+		else
+		{
+			t = next_y;
+			next_y += delta_y;
+			y += step_y;
+		}
+	}
+}
+
+// Swept AABB test of box 1 moving by 'displacement' against box 2 at rest, boxes given by their top-left corner and size
+// Returns true if box 1 enters box 2 within this displacement; t_hit is the fraction of the displacement at the
+// first contact and axis the axis of the contact (0 for x, 1 for y). Boxes that already overlap do not count.
+bool sweep_collides(const vec2 &pos1, const vec2 &bb1, const vec2 &displacement, const vec2 &pos2, const vec2 &bb2, float &t_hit, int &axis)
+{
+	float entry[2];
+	float exit[2];
+	for (int a = 0; a < 2; a++)
+	{
+		if (displacement[a] == 0.f)
+		{
+			// boxes only touching at their sides slide past each other
+			if (pos1[a] >= pos2[a] + bb2[a] || pos2[a] >= pos1[a] + bb1[a])
+			{
+				return false;
+			}
+			entry[a] = -std::numeric_limits<float>::infinity();
+			exit[a] = std::numeric_limits<float>::infinity();
+		}
+		else if (displacement[a] > 0.f)
+		{
+			entry[a] = (pos2[a] - (pos1[a] + bb1[a])) / displacement[a];
+			exit[a] = (pos2[a] + bb2[a] - pos1[a]) / displacement[a];
+		}
+		else
+		{
+			entry[a] = (pos2[a] + bb2[a] - pos1[a]) / displacement[a];
+			exit[a] = (pos2[a] - (pos1[a] + bb1[a])) / displacement[a];
+		}
+	}
+	axis = entry[0] > entry[1] ? 0 : 1;
+	t_hit = max(entry[0], entry[1]);
+	return t_hit >= 0.f && t_hit <= 1.f && t_hit < min(exit[0], exit[1]);
+}
+
+// Separating axis test of a triangle against a box given by its corners, touching counts as a collision
+bool triangle_collides(const vec2 *corners, const vec2 &box_min, const vec2 &box_max)
+{
+	// the axes of the box
+	if (max(corners[0].x, max(corners[1].x, corners[2].x)) < box_min.x || min(corners[0].x, min(corners[1].x, corners[2].x)) > box_max.x ||
+			max(corners[0].y, max(corners[1].y, corners[2].y)) < box_min.y || min(corners[0].y, min(corners[1].y, corners[2].y)) > box_max.y)
 	{
-		std::cout << "mesh_collides: mesh_entity not a textured mesh" << std::endl;
 		return false;
 	}
-	TexturedMesh *mesh = registry.texturedMeshPtrs.get(mesh_entity);
-	auto &vertices = mesh->vertices;
-	auto &indices = mesh->vertex_indices;
-	// use original bounding box (without bb_scale) for actual mesh collision use
-	// vec2 mesh_bb = {abs(mesh_motion.scale.x), abs(mesh_motion.scale.y)};
-	// vec2 mesh_center = mesh_motion.position;
-	vec2 box_bb = get_bounding_box(box_motion);
-	vec2 box_pos = box_motion.position + box_motion.bb_offset - box_bb / 2.f;
-	glm::mat3 transform = get_transform(mesh_motion);
-	for (uint i = 0; i < indices.size(); i += 3)
-	{
-		vec2 v1 = vertices[indices[i]].position;
-		vec2 v2 = vertices[indices[i + 1]].position;
-		vec2 v3 = vertices[indices[i + 2]].position;
-		vec2 p1 = xy(transform * vec3(v1, 1));
-		vec2 p2 = xy(transform * vec3(v2, 1));
-		vec2 p3 = xy(transform * vec3(v3, 1));
-		// collides if any of the three points of the triangle is inside the box
-		if (is_point_in_box(p1, box_pos, box_bb) || is_point_in_box(p2, box_pos, box_bb) || is_point_in_box(p3, box_pos, box_bb))
-		{
-			// std::cout << "mesh_collides point_in_box" << std::endl;
-			return true;
+	// the normals of the triangle edges
+	vec2 box_center = (box_min + box_max) / 2.f;
+	vec2 box_half = (box_max - box_min) / 2.f;
+	for (int e = 0; e < 3; e++)
+	{
+		vec2 edge = corners[(e + 1) % 3] - corners[e];
+		vec2 normal = {-edge.y, edge.x};
+		// both corners of the edge project to the same point
+		float edge_projection = dot(normal, corners[e]);
+		float opposite_projection = dot(normal, corners[(e + 2) % 3]);
+		float box_projection = dot(normal, box_center);
+		float box_radius = box_half.x * abs(normal.x) + box_half.y * abs(normal.y);
+		if (box_projection + box_radius < min(edge_projection, opposite_projection) || box_projection - box_radius > max(edge_projection, opposite_projection))
+		{
+			return false;
 		}
-		// collides if any of the three edges of the triangle intersects with the box
-		if (line_intersects(p1, p2, box_pos, box_pos + vec2{box_bb.x, 0}) ||
-				line_intersects(p1, p2, box_pos, box_pos + vec2{0, box_bb.y}) ||
-				line_intersects(p1, p2, box_pos + box_bb, box_pos + box_bb - vec2{box_bb.x, 0}) ||
-				line_intersects(p1, p2, box_pos + box_bb, box_pos + box_bb - vec2{0, box_bb.y}) ||
-				line_intersects(p2, p3, box_pos, box_pos + vec2{box_bb.x, 0}) ||
-				line_intersects(p2, p3, box_pos, box_pos + vec2{0, box_bb.y}) ||
-				line_intersects(p2, p3, box_pos + box_bb, box_pos + box_bb - vec2{box_bb.x, 0}) ||
-				line_intersects(p2, p3, box_pos + box_bb, box_pos + box_bb - vec2{0, box_bb.y}) ||
-				line_intersects(p3, p1, box_pos, box_pos + vec2{box_bb.x, 0}) ||
-				line_intersects(p3, p1, box_pos, box_pos + vec2{0, box_bb.y}) ||
-				line_intersects(p3, p1, box_pos + box_bb, box_pos + box_bb - vec2{box_bb.x, 0}) ||
-				line_intersects(p3, p1, box_pos + box_bb, box_pos + box_bb - vec2{0, box_bb.y}))
-		{
-			// std::cout << "mesh_collides line_intersects" << std::endl;
+	}
+	return true;
+}
+
+bool mesh_collides(const MeshCollider &mesh_collider, const Motion &box_motion)
+{
+	vec2 box_bb = get_bounding_box(box_motion);
+	vec2 box_min = box_motion.position + box_motion.bb_offset - box_bb / 2.f;
+	vec2 box_max = box_min + box_bb;
+	// most boxes near the weapon are still outside of its triangles' bounds
+	if (mesh_collider.bounds_max.x < box_min.x || mesh_collider.bounds_min.x > box_max.x || mesh_collider.bounds_max.y < box_min.y || mesh_collider.bounds_min.y > box_max.y)
+	{
+		return false;
+	}
+	for (uint i = 0; i + 2 < mesh_collider.corners.size(); i += 3)
+	{
+		if (triangle_collides(&mesh_collider.corners[i], box_min, box_max))
+		{
 			return true;
 		}
 	}
 	return false;
 }
 
+// Transforms the triangles of the entity's mesh to world space for this step's hit tests
+void update_mesh_collider(Entity entity, MeshCollider &mesh_collider)
+{
+	// ONLY WEAPON MESH is supported
+	if (!registry.texturedMeshPtrs.has(entity))
+	{
+		std::cout << "update_mesh_collider: entity not a textured mesh" << std::endl;
+		mesh_collider.corners.clear();
+		return;
+	}
+	TexturedMesh *mesh = registry.texturedMeshPtrs.get(entity);
+	auto &vertices = mesh->vertices;
+	auto &indices = mesh->vertex_indices;
+	glm::mat3 transform = get_transform(registry.motions.get(entity));
+	mesh_collider.corners.resize(indices.size());
+	for (uint i = 0; i < indices.size(); i++)
+	{
+		vec2 corner = xy(transform * vec3(xy(vertices[indices[i]].position), 1));
+		mesh_collider.corners[i] = corner;
+		mesh_collider.bounds_min = i == 0 ? corner : min(mesh_collider.bounds_min, corner);
+		mesh_collider.bounds_max = i == 0 ? corner : max(mesh_collider.bounds_max, corner);
+	}
+}
+
+void set_velocity(Entity entity, vec2 velocity)
+{
+	registry.motions.get(entity).velocity = velocity;
+	if (velocity != vec2(0.f, 0.f) && !registry.moving.has(entity))
+	{
+		registry.moving.insert(entity);
+	}
+}
+
 void PhysicsSystem::step(float elapsed_ms)
 {
-	// Move all entities according to their velocity
+	// Move the entities of the active set according to their velocity, all other motions are at rest
 	auto &motion_registry = registry.motions;
-	for (uint i = 0; i < motion_registry.size(); i++)
+	float step_seconds = elapsed_ms / 1000.f;
+	TagContainer<Moving> &moving = registry.moving;
+	integrated_count = 0;
+	for (uint i = (uint)moving.entities.size(); i-- > 0;)
 	{
-		Motion &motion = motion_registry.components[i];
-		// Entity entity = motion_registry.entities[i];
-		float step_seconds = elapsed_ms / 1000.f;
+		Entity entity = moving.entities[i];
+		// removing swaps the last entity to i, which was already visited
+		if (!motion_registry.has(entity))
+		{
+			moving.remove(entity);
+			continue;
+		}
+		Motion &motion = motion_registry.get(entity);
+		if (motion.velocity == vec2(0.f, 0.f))
+		{
+			moving.remove(entity);
+			continue;
+		}
 		motion.position += motion.velocity * step_seconds;
+		integrated_count++;
 	}
 
+	// Fast bodies could have passed through a wall or the player, move them back to their first contact
+	update_static_grid();
+	sweep_fast_bodies(step_seconds);
+
 	// After movement, before collision checks. Do all relative position calculations here
 	Entity player = registry.players.entities[0];
 	Player &player_comp = registry.players.components[0];
@@ -147,9 +320,14 @@ void PhysicsSystem::step(float elapsed_ms)
 		weapon_motion.angle = -weapon_motion.angle;
 	}
 	weapon_motion.position = player_motion.position + weapon_offset;
+	// The weapon does not move any more during this step
+	for (uint i = 0; i < registry.meshColliders.size(); i++)
+	{
+		update_mesh_collider(registry.meshColliders.entities[i], registry.meshColliders.components[i]);
+	}
 
 	// Update damage area status & position
-	for (int i = registry.damageAreas.components.size() - 1; i >= 0; i--)
+	for (uint i = 0; i < registry.damageAreas.components.size(); i++)
 	{
 		DamageArea &damage_area = registry.damageAreas.components[i];
 		Entity owner_entity = damage_area.owner;
@@ -166,7 +344,10 @@ void PhysicsSystem::step(float elapsed_ms)
 		damage_area.time_until_destroyed -= elapsed_ms;
 		if (damage_area.time_until_destroyed <= 0.f)
 		{
-			registry.remove_all_components_of(damage_area_entity);
+			// removed at the end of the frame, make sure it deals no more damage until then
+			commands.destroy(damage_area_entity);
+			damage_area.active = false;
+			continue;
 		}
 
 		if (!damage_area.active)
@@ -180,8 +361,16 @@ void PhysicsSystem::step(float elapsed_ms)
 	}
 
 	// Check for collisions between all moving entities
+	// Broad phase: the moving bodies are binned into a grid every step, the static ones only when they change
+	auto broad_phase_start = std::chrono::steady_clock::now();
 	ComponentContainer<PhysicsBody> &physicsBody_container = registry.physicsBodies;
-	std::set<Entity> entities_to_remove;
+	update_dynamic_grid();
+	// Stand-in body for the wall tile currently tested, walls have no entity
+	PhysicsBody wall_body = {BodyType::STATIC, CollisionLayer::WALL};
+	Motion wall_motion;
+	wall_motion.bb_scale = {TILE_SCALE, TILE_SCALE};
+	pair_tests = 0;
+	solver_contacts.clear();
 	for (uint i = 0; i < physicsBody_container.components.size(); i++)
 	{
 		PhysicsBody &physicsBody_i = physicsBody_container.components[i];
@@ -192,50 +381,41 @@ void PhysicsSystem::step(float elapsed_ms)
 		Entity entity_i = physicsBody_container.entities[i];
 		Motion &motion_i = motion_registry.get(entity_i);
 
-		for (uint j = 0; j < physicsBody_container.components.size(); j++)
+		// Narrow phase and resolution of one candidate pair
+		auto check_pair = [&](Entity entity_j, PhysicsBody &physicsBody_j, Motion &motion_j)
 		{
-			if (j == i)
-			{
-				continue;
-			}
-			PhysicsBody &physicsBody_j = physicsBody_container.components[j];
-			if (j < i && physicsBody_j.body_type != BodyType::STATIC)
-			{
-				// this pair is already processed
-				continue;
-			}
-			Entity entity_j = physicsBody_container.entities[j];
-			Motion &motion_j = motion_registry.get(entity_j);
-
 			vec2 b1 = get_bounding_box(motion_i);
 			vec2 b2 = get_bounding_box(motion_j);
 			vec2 p1 = motion_i.position + motion_i.bb_offset - b1 / 2.f;
 			vec2 p2 = motion_j.position + motion_j.bb_offset - b2 / 2.f;
 
-			if (collides(motion_i, motion_j))
+			pair_tests++;
+			bool solid = is_solid(physicsBody_i.body_type) && is_solid(physicsBody_j.body_type);
+			if (!collides(motion_i, motion_j))
+			{
+				// Bodies facing each other across a small gap can be pushed together while the contacts are solved,
+				// the solver keeps them apart
+				float overlap_x = min(p1.x + b1.x - p2.x, p2.x + b2.x - p1.x);
+				float overlap_y = min(p1.y + b1.y - p2.y, p2.y + b2.y - p1.y);
+				if (solid && min(overlap_x, overlap_y) >= -BROAD_PHASE_MARGIN && max(overlap_x, overlap_y) > 0.f)
+				{
+					add_solver_contact(entity_i, physicsBody_i, motion_i, entity_j, physicsBody_j, motion_j);
+				}
+				return;
+			}
 			{
 				if (entity_i == weapon || entity_j == weapon)
 				{
-					if (entity_i == player || entity_j == player)
+					if (entity_i == weapon && registry.meshColliders.has(entity_i) && !mesh_collides(registry.meshColliders.get(entity_i), motion_j))
 					{
-						// ignore weapon collision with player
-						continue;
+						return;
 					}
-					if (entity_i == weapon && !mesh_collides(entity_i, motion_i, motion_j))
+					if (entity_j == weapon && registry.meshColliders.has(entity_j) && !mesh_collides(registry.meshColliders.get(entity_j), motion_i))
 					{
-						continue;
-					}
-					if (entity_j == weapon && !mesh_collides(entity_j, motion_j, motion_i))
-					{
-						continue;
+						return;
 					}
 				}
 
-				if (physicsBody_i.body_type == BodyType::PROJECTILE && physicsBody_j.body_type == BodyType::PROJECTILE)
-				{
-					// projectiles do not collide with each other
-					continue;
-				}
 				if (physicsBody_i.body_type == BodyType::PROJECTILE || physicsBody_j.body_type == BodyType::PROJECTILE)
 				{
 					bool is_i_projectile = physicsBody_i.body_type == BodyType::PROJECTILE;
@@ -258,95 +438,512 @@ void PhysicsSystem::step(float elapsed_ms)
 							player_health.take_damage(projectile_damage.damage);
 						}
 
-						entities_to_remove.insert(projectile_entity);
+						commands.destroy(projectile_entity);
 					}
 					else if (other_body.body_type == BodyType::STATIC)
 					{
 						// projectiles are destroyed when they hit walls
-						entities_to_remove.insert(projectile_entity);
+						commands.destroy(projectile_entity);
 					}
-					continue;
+					return;
 				}
 
 				// std::cout << "position of i: " << p1.x << "," << p1.y << "; position of j: " << p2.x << "," << p2.y << std::endl;
 				// std::cout << "bb of i: " << b1.x << "," << b1.y << "; bb of j: " << b2.x << "," << b2.y << std::endl;
 
-				// Create a collisions event
-				// We are abusing the ECS system a bit in that we potentially insert muliple collisions for the same entity
-				registry.collisions.emplace_with_duplicates(entity_i, entity_j);
-				registry.collisions.emplace_with_duplicates(entity_j, entity_i);
+				float depth;
+				vec2 normal = contact_normal(motion_i, motion_j, depth);
 
-				if (physicsBody_i.body_type == BodyType::NONE || physicsBody_j.body_type == BodyType::NONE)
+				// Report the contact to the gameplay handlers of the two layers
+				contacts.add(entity_i, entity_j, normal, depth, physicsBody_i.layer, physicsBody_j.layer);
+
+				// None bodies do not need collision resolution, solid ones are separated once all contacts are found
+				if (solid)
 				{
-					// None bodies do not need collision resolution
-					continue;
+					add_solver_contact(entity_i, physicsBody_i, motion_i, entity_j, physicsBody_j, motion_j);
 				}
+			}
+		};
 
-				// aabb collision resolution
-				float overlap_x = min(p1.x + b1.x - p2.x, p2.x + b2.x - p1.x);
-				float overlap_y = min(p1.y + b1.y - p2.y, p2.y + b2.y - p1.y);
-				// std::cout << "overlap: " << overlap_x << "," << overlap_y << std::endl;
-				if (physicsBody_j.body_type == BodyType::STATIC)
+		// Only the wall tiles and bodies sharing a grid cell with body i are candidates
+		// body i can be pushed while its pairs are resolved, hence the margin around it
+		vec2 bb_i = get_bounding_box(motion_i);
+		vec2 box_min_i = motion_i.position + motion_i.bb_offset - bb_i / 2.f;
+		// pairs whose layers never interact are skipped before any bounding box is looked at
+		if (physicsBody_i.accepts(wall_body))
+		{
+			int x0, y0, x1, y1;
+			wall_tiles.tile_range(box_min_i - BROAD_PHASE_MARGIN, box_min_i + bb_i + BROAD_PHASE_MARGIN, x0, y0, x1, y1);
+			for (int y = y0; y <= y1; y++)
+			{
+				for (int x = x0; x <= x1; x++)
 				{
-					if (overlap_x < overlap_y)
+					if (!wall_tiles.is_solid(x, y))
 					{
-						if (p1.x < p2.x)
-						{
-							motion_i.position.x -= overlap_x;
-						}
-						else
-						{
-							motion_i.position.x += overlap_x;
-						}
+						continue;
 					}
-					else
-					{
-						if (p1.y < p2.y)
-						{
-							motion_i.position.y -= overlap_y;
-						}
-						else
+					wall_motion.position = {(x + 0.5f) * TILE_SCALE, (y + 0.5f) * TILE_SCALE};
+					check_pair(Entity(0), wall_body, wall_motion);
+				}
+			}
+		}
+		query_candidates(static_grid, box_min_i - BROAD_PHASE_MARGIN, box_min_i + bb_i + BROAD_PHASE_MARGIN);
+		for (unsigned int k : candidates)
+		{
+			Entity entity_j = static_entities[k];
+			PhysicsBody &physicsBody_j = physicsBody_container.get(entity_j);
+			if (physicsBody_i.accepts(physicsBody_j))
+			{
+				check_pair(entity_j, physicsBody_j, motion_registry.get(entity_j));
+			}
+		}
+		query_candidates(dynamic_grid, box_min_i, box_min_i + bb_i);
+		for (unsigned int j : candidates)
+		{
+			// pairs of two moving bodies are processed once, from the lower index
+			if (j <= i || !physicsBody_i.accepts(physicsBody_container.components[j]))
+			{
+				continue;
+			}
+			Entity entity_j = physicsBody_container.entities[j];
+			check_pair(entity_j, physicsBody_container.components[j], motion_registry.get(entity_j));
+		}
+	}
+	collision_detection_us = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - broad_phase_start).count();
+
+	solve_contacts();
+
+	// the bodies have moved, keep the distance lookups of the gameplay code up to date
+	spatial_index.update();
+}
+
+void PhysicsSystem::add_solver_contact(Entity entity_a, const PhysicsBody &body_a, Motion &motion_a, Entity entity_b, const PhysicsBody &body_b, Motion &motion_b)
+{
+	SolverContact contact;
+	contact.entity_a = entity_a;
+	contact.entity_b = entity_b;
+	contact.motion_a = &motion_a;
+	// wall tiles are tested with a stand-in motion that is reused for the next tile
+	contact.motion_b = (unsigned int)entity_b == 0 ? nullptr : &motion_b;
+	contact.wall_center = motion_b.position + motion_b.bb_offset;
+	float depth;
+	contact.normal = contact_normal(motion_a, motion_b, depth);
+	float inverse_mass_a = inverse_mass(body_a.body_type);
+	float inverse_mass_b = inverse_mass(body_b.body_type);
+	contact.share_a = inverse_mass_a / (inverse_mass_a + inverse_mass_b);
+	contact.share_b = inverse_mass_b / (inverse_mass_a + inverse_mass_b);
+	// The pair is stored the same way whichever body the broad phase visited first
+	if (contact.motion_b && contact.share_b > 0 && (unsigned int)entity_b < (unsigned int)entity_a)
+	{
+		std::swap(contact.entity_a, contact.entity_b);
+		std::swap(contact.motion_a, contact.motion_b);
+		std::swap(contact.share_a, contact.share_b);
+		contact.normal = -contact.normal;
+	}
+	solver_contacts.push_back(contact);
+}
+
+void PhysicsSystem::solve_contacts()
+{
+	ComponentContainer<Motion> &motion_registry = registry.motions;
+	// Sorted by their bodies, the solve does not depend on the order the bodies are stored in
+	std::sort(solver_contacts.begin(), solver_contacts.end(), [](const SolverContact &c1, const SolverContact &c2)
 						{
-							motion_i.position.y += overlap_y;
-						}
-					}
+							if (c1.entity_a != c2.entity_a)
+								return (unsigned int)c1.entity_a < (unsigned int)c2.entity_a;
+							if (c1.entity_b != c2.entity_b)
+								return (unsigned int)c1.entity_b < (unsigned int)c2.entity_b;
+							return c1.wall_center.x < c2.wall_center.x || (c1.wall_center.x == c2.wall_center.x && c1.wall_center.y < c2.wall_center.y);
+						});
+
+	// Greedy graph coloring: two contacts of the same color never move the same body, so the contacts of one color
+	// are independent of each other and can be solved in any order or on separate threads
+	// only the entries of bodies with contacts are set, they are cleared again below
+	if (used_colors.size() < motion_registry.size())
+		used_colors.resize(motion_registry.size(), 0);
+	for (SolverContact &contact : solver_contacts)
+	{
+		uint64_t used = 0;
+		size_t index_a = contact.motion_a - motion_registry.components.data();
+		size_t index_b = contact.motion_b ? contact.motion_b - motion_registry.components.data() : 0;
+		bool moves_b = contact.motion_b && contact.share_b > 0;
+		used |= used_colors[index_a];
+		if (moves_b)
+			used |= used_colors[index_b];
+		// a body with more contacts than colors shares the last one, those contacts are then solved one after another
+		contact.color = MAX_SOLVER_COLORS - 1;
+		for (unsigned int c = 0; c < MAX_SOLVER_COLORS; c++)
+		{
+			if (!(used & (uint64_t(1) << c)))
+			{
+				contact.color = c;
+				break;
+			}
+		}
+		used_colors[index_a] |= uint64_t(1) << contact.color;
+		if (moves_b)
+			used_colors[index_b] |= uint64_t(1) << contact.color;
+	}
+	for (SolverContact &contact : solver_contacts)
+	{
+		used_colors[contact.motion_a - motion_registry.components.data()] = 0;
+		if (contact.motion_b)
+			used_colors[contact.motion_b - motion_registry.components.data()] = 0;
+	}
+	std::stable_sort(solver_contacts.begin(), solver_contacts.end(), [](const SolverContact &c1, const SolverContact &c2)
+									 { return c1.color < c2.color; });
+
+	// Position based relaxation: every contact pushes its bodies apart by the overlap they still have
+	// along the normal, split by inverse mass, until no contact moves a body noticeably
+	const vec2 wall_half = {TILE_SCALE / 2.f, TILE_SCALE / 2.f};
+	for (int iteration = 0; iteration < SOLVER_ITERATIONS; iteration++)
+	{
+		float largest_correction = 0.f;
+		for (size_t begin = 0, end = 0; begin < solver_contacts.size(); begin = end)
+		{
+			// one batch of independent contacts
+			while (end < solver_contacts.size() && solver_contacts[end].color == solver_contacts[begin].color)
+				end++;
+			for (size_t k = begin; k < end; k++)
+			{
+				SolverContact &contact = solver_contacts[k];
+				Motion &motion_a = *contact.motion_a;
+				vec2 center_a = motion_a.position + motion_a.bb_offset;
+				vec2 half_a = get_bounding_box(motion_a) / 2.f;
+				vec2 center_b = contact.motion_b ? contact.motion_b->position + contact.motion_b->bb_offset : contact.wall_center;
+				vec2 half_b = contact.motion_b ? get_bounding_box(*contact.motion_b) / 2.f : wall_half;
+				float depth = dot(half_a + half_b, abs(contact.normal)) - dot(center_b - center_a, contact.normal);
+				if (depth <= 0.f)
+				{
+					continue;
 				}
-				else
+				motion_a.position -= contact.normal * (depth * contact.share_a);
+				if (contact.motion_b)
 				{
-					if (overlap_x < overlap_y)
-					{
-						if (p1.x < p2.x)
-						{
-							motion_i.position.x -= overlap_x / 2;
-							motion_j.position.x += overlap_x / 2;
-						}
-						else
-						{
-							motion_i.position.x += overlap_x / 2;
-							motion_j.position.x -= overlap_x / 2;
-						}
-					}
-					else
+					contact.motion_b->position += contact.normal * (depth * contact.share_b);
+				}
+				largest_correction = max(largest_correction, depth);
+			}
+		}
+		if (largest_correction < SOLVER_TOLERANCE)
+		{
+			break;
+		}
+	}
+}
+void PhysicsSystem::sweep_fast_bodies(float step_seconds)
+{
+	ComponentContainer<PhysicsBody> &physicsBody_container = registry.physicsBodies;
+	ComponentContainer<Motion> &motion_registry = registry.motions;
+	Entity player = registry.players.entities[0];
+	// the player loses its body when it dies, then it is neither swept nor hit
+	PhysicsBody *player_body = physicsBody_container.has(player) ? &physicsBody_container.get(player) : nullptr;
+	Motion &player_motion = motion_registry.get(player);
+	// walls have no body, see step()
+	PhysicsBody wall_body = {BodyType::STATIC, CollisionLayer::WALL};
+	vec2 player_bb = get_bounding_box(player_motion);
+	vec2 player_displacement = player_motion.velocity * step_seconds;
+	vec2 player_start = player_motion.position + player_motion.bb_offset - player_bb / 2.f - player_displacement;
+
+	// The player is swept first, the others are then swept against where it really ends this step
+	for (uint n = 0; n <= physicsBody_container.components.size(); n++)
+	{
+		Entity entity = n == 0 ? player : physicsBody_container.entities[n - 1];
+		if ((n > 0 && entity == player) || (n == 0 && !player_body))
+		{
+			continue;
+		}
+		PhysicsBody &physicsBody = physicsBody_container.get(entity);
+		BodyType body_type = physicsBody.body_type;
+		if (body_type == BodyType::STATIC)
+		{
+			continue;
+		}
+		Motion &motion = motion_registry.get(entity);
+		vec2 displacement = motion.velocity * step_seconds;
+		vec2 bb = get_bounding_box(motion);
+		// Projectiles are always swept, other bodies only when they move more than half their size, e.g. dashes or long frames
+		bool is_fast = abs(displacement.x) > bb.x / 2.f || abs(displacement.y) > bb.y / 2.f;
+		if ((body_type != BodyType::PROJECTILE && !is_fast) || (displacement.x == 0.f && displacement.y == 0.f))
+		{
+			continue;
+		}
+
+		// Start of the step, the position was already integrated
+		vec2 box_min = motion.position + motion.bb_offset - bb / 2.f - displacement;
+		vec2 remaining = displacement;
+		// Kinematic bodies slide along what they hit, at most once per axis
+		for (int iteration = 0; iteration < 3; iteration++)
+		{
+			float t_first = 1.f;
+			int axis_first = -1;
+			bool hits_player = false;
+			float t_hit;
+			int axis;
+
+			vec2 sweep_min = min(box_min, box_min + remaining);
+			vec2 sweep_max = max(box_min, box_min + remaining) + bb;
+			int x0 = 0, y0 = 0, x1 = -1, y1 = -1;
+			if (physicsBody.accepts(wall_body))
+			{
+				wall_tiles.tile_range(sweep_min, sweep_max, x0, y0, x1, y1);
+			}
+			for (int y = y0; y <= y1; y++)
+			{
+				for (int x = x0; x <= x1; x++)
+				{
+					vec2 tile_min = {x * TILE_SCALE, y * TILE_SCALE};
+					if (wall_tiles.is_solid(x, y) && sweep_collides(box_min, bb, remaining, tile_min, {TILE_SCALE, TILE_SCALE}, t_hit, axis) && t_hit < t_first)
 					{
-						if (p1.y < p2.y)
-						{
-							motion_i.position.y -= overlap_y / 2;
-							motion_j.position.y += overlap_y / 2;
-						}
-						else
-						{
-							motion_i.position.y += overlap_y / 2;
-							motion_j.position.y -= overlap_y / 2;
-						}
+						t_first = t_hit;
+						axis_first = axis;
 					}
 				}
 			}
+			query_candidates(static_grid, sweep_min, sweep_max);
+			for (unsigned int k : candidates)
+			{
+				if (!physicsBody.accepts(physicsBody_container.get(static_entities[k])))
+				{
+					continue;
+				}
+				Motion &static_motion = motion_registry.get(static_entities[k]);
+				vec2 static_bb = get_bounding_box(static_motion);
+				vec2 static_min = static_motion.position + static_motion.bb_offset - static_bb / 2.f;
+				if (sweep_collides(box_min, bb, remaining, static_min, static_bb, t_hit, axis) && t_hit < t_first)
+				{
+					t_first = t_hit;
+					axis_first = axis;
+				}
+			}
+			// The player moves in the same step, so it is swept against with the relative displacement, before any sliding
+			vec2 relative = displacement - player_displacement;
+			if (iteration == 0 && entity != player && player_body && physicsBody.accepts(*player_body) &&
+					sweep_collides(box_min, bb, relative, player_start, player_bb, t_hit, axis) && t_hit < t_first)
+			{
+				t_first = t_hit;
+				axis_first = axis;
+				hits_player = true;
+			}
+
+			if (axis_first < 0)
+			{
+				box_min += remaining;
+				break;
+			}
+			if (hits_player)
+			{
+				// stop just inside the player, keeping the offset to the player at the contact
+				vec2 player_end = player_motion.position + player_motion.bb_offset - player_bb / 2.f;
+				box_min = player_end + (box_min - player_start) + relative * (t_first + CONTACT_SKIN / length(relative));
+				break;
+			}
+			if (body_type != BodyType::KINEMATIC)
+			{
+				// stop just inside, the narrow phase then destroys the projectile or reports the hit
+				box_min += remaining * min(t_first + CONTACT_SKIN / length(remaining), 1.f);
+				break;
+			}
+			// stop just short of the contact and keep moving along it
+			box_min += remaining * max(t_first - CONTACT_SKIN / length(remaining), 0.f);
+			remaining *= 1.f - t_first;
+			remaining[axis_first] = 0.f;
+			if (remaining.x == 0.f && remaining.y == 0.f)
+			{
+				break;
+			}
+		}
+		motion.position = box_min - motion.bb_offset + bb / 2.f;
+	}
+}
+
+void PhysicsSystem::update_static_grid()
+{
+	ComponentContainer<PhysicsBody> &physicsBody_container = registry.physicsBodies;
+	ComponentContainer<Motion> &motion_registry = registry.motions;
+
+	int grid_width = max((int)level_grid.size(), 1);
+	int grid_height = level_grid.size() > 0 ? max((int)level_grid[0].size(), 1) : 1;
+	bool level_changed = grid_width != static_grid.get_width() || grid_height != static_grid.get_height();
+	if (level_changed)
+	{
+		static_grid.resize(grid_width, grid_height);
+		dynamic_grid.resize(grid_width, grid_height);
+	}
+
+	// Statics never move, so they only need to be re-binned when one was added or removed
+	unsigned int static_count = 0;
+	for (uint i = 0; i < physicsBody_container.components.size(); i++)
+	{
+		if (physicsBody_container.components[i].body_type == BodyType::STATIC)
+		{
+			static_count++;
+		}
+	}
+	bool statics_changed = level_changed || static_count != static_entities.size();
+	for (uint k = 0; k < static_entities.size() && !statics_changed; k++)
+	{
+		Entity entity = static_entities[k];
+		statics_changed = !physicsBody_container.has(entity) || physicsBody_container.get(entity).body_type != BodyType::STATIC;
+	}
+	if (!statics_changed)
+	{
+		return;
+	}
+
+	static_entities.clear();
+	static_grid.clear();
+	for (uint i = 0; i < physicsBody_container.components.size(); i++)
+	{
+		if (physicsBody_container.components[i].body_type != BodyType::STATIC)
+		{
+			continue;
+		}
+		Entity entity = physicsBody_container.entities[i];
+		Motion &motion = motion_registry.get(entity);
+		vec2 bb = get_bounding_box(motion);
+		vec2 box_min = motion.position + motion.bb_offset - bb / 2.f;
+		static_grid.add(static_entities.size(), box_min, box_min + bb);
+		static_entities.push_back(entity);
+	}
+	static_grid.build();
+}
+
+void PhysicsSystem::update_dynamic_grid()
+{
+	ComponentContainer<PhysicsBody> &physicsBody_container = registry.physicsBodies;
+	ComponentContainer<Motion> &motion_registry = registry.motions;
+
+	dynamic_grid.clear();
+	dynamic_entities.assign(physicsBody_container.entities.begin(), physicsBody_container.entities.end());
+	for (uint i = 0; i < physicsBody_container.components.size(); i++)
+	{
+		if (physicsBody_container.components[i].body_type == BodyType::STATIC)
+		{
+			continue;
 		}
+		// the bins are made before resolution moves the bodies, the margin keeps pushed bodies in their bins
+		Motion &motion = motion_registry.get(physicsBody_container.entities[i]);
+		vec2 bb = get_bounding_box(motion);
+		vec2 box_min = motion.position + motion.bb_offset - bb / 2.f;
+		dynamic_grid.add(i, box_min - BROAD_PHASE_MARGIN, box_min + bb + BROAD_PHASE_MARGIN);
 	}
+	dynamic_grid.build();
+}
+
+void PhysicsSystem::query_candidates(const SpatialGrid &grid, vec2 box_min, vec2 box_max)
+{
+	candidates.clear();
+	grid.query(box_min, box_max, candidates);
+	// a body spanning several cells is found once per cell; sorting also keeps the original pair order
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+}
 
-	for (Entity entity : entities_to_remove)
+template <typename OnHit>
+void PhysicsSystem::raycast_cell(int x, int y, vec2 origin, vec2 direction, unsigned int mask, OnHit on_hit)
+{
+	ComponentContainer<PhysicsBody> &physicsBody_container = registry.physicsBodies;
+	float t;
+	vec2 normal;
+	if ((mask & layer_bit(CollisionLayer::WALL)) && wall_tiles.is_solid(x, y))
 	{
-		// std::cout << "removing entity " << entity << std::endl;
-		registry.remove_all_components_of(entity);
+		vec2 tile_min = vec2(x, y) * TILE_SCALE;
+		if (ray_hits_box(origin, direction, tile_min, tile_min + TILE_SCALE, t, normal))
+		{
+			on_hit(RaycastHit{Entity(0), origin + direction * t, normal, t});
+		}
 	}
-}
\ No newline at end of file
+
+	auto test_body = [&](Entity entity)
+	{
+		// the grids are from the last step, the body may be gone by now
+		if (!physicsBody_container.has(entity) || !(mask & layer_bit(physicsBody_container.get(entity).layer)))
+		{
+			return;
+		}
+		Motion &motion = registry.motions.get(entity);
+		vec2 bb = get_bounding_box(motion);
+		vec2 box_min = motion.position + motion.bb_offset - bb / 2.f;
+		if (ray_hits_box(origin, direction, box_min, box_min + bb, t, normal))
+		{
+			on_hit(RaycastHit{entity, origin + direction * t, normal, t});
+		}
+	};
+	query_items.clear();
+	static_grid.query_cell(x, y, query_items);
+	for (unsigned int k : query_items)
+	{
+		test_body(static_entities[k]);
+	}
+	query_items.clear();
+	dynamic_grid.query_cell(x, y, query_items);
+	for (unsigned int j : query_items)
+	{
+		test_body(dynamic_entities[j]);
+	}
+}
+
+bool PhysicsSystem::raycast(vec2 origin, vec2 direction, float max_distance, unsigned int mask, RaycastHit &hit)
+{
+	float direction_length = length(direction);
+	if (direction_length == 0.f)
+	{
+		return false;
+	}
+	direction /= direction_length;
+
+	bool found = false;
+	hit.distance = max_distance;
+	walk_cells(origin, direction, max_distance, [&](int x, int y, float t_enter)
+						 {
+							 // a box is found in the cell where the ray enters it, so later cells cannot have a closer hit
+							 if (found && t_enter > hit.distance)
+							 {
+								 return false;
+							 }
+							 raycast_cell(x, y, origin, direction, mask, [&](const RaycastHit &cell_hit)
+													{
+														if (cell_hit.distance <= hit.distance)
+														{
+															hit = cell_hit;
+															found = true;
+														}
+													});
+							 return true; });
+	return found;
+}
+
+void PhysicsSystem::segment_query(vec2 start, vec2 end, unsigned int mask, std::vector<RaycastHit> &hits)
+{
+	hits.clear();
+	float segment_length = length(end - start);
+	if (segment_length == 0.f)
+	{
+		return;
+	}
+	vec2 direction = (end - start) / segment_length;
+	walk_cells(start, direction, segment_length, [&](int x, int y, float)
+						 {
+							 raycast_cell(x, y, start, direction, mask, [&](const RaycastHit &hit)
+													{
+														if (hit.distance <= segment_length)
+														{
+															hits.push_back(hit);
+														}
+													});
+							 return true; });
+
+	// a body spanning several cells is found once per cell, always with the same hit
+	std::sort(hits.begin(), hits.end(), [](const RaycastHit &h1, const RaycastHit &h2)
+						{ return h1.distance < h2.distance || (h1.distance == h2.distance && (unsigned int)h1.entity < (unsigned int)h2.entity); });
+	hits.erase(std::unique(hits.begin(), hits.end(), [](const RaycastHit &h1, const RaycastHit &h2)
+												 { return h1.entity == h2.entity && h1.distance == h2.distance && h1.point == h2.point; }),
+						 hits.end());
+}
+
+bool PhysicsSystem::line_of_sight(vec2 start, vec2 end)
+{
+	RaycastHit hit;
+	return !raycast(start, end - start, length(end - start), layer_bit(CollisionLayer::WALL), hit);
+}
@@ -4,17 +4,92 @@
 #include "tiny_ecs.hpp"
 #include "components.hpp"
 #include "tiny_ecs_registry.hpp"
+#include "spatial_grid.hpp"
 
 vec2 get_bounding_box(const Motion &motion);
 vec2 xy(const vec3 &v);
 
+// Sets the velocity of an entity's motion; a non-zero velocity adds the entity to the physics system's active set
+// Velocities written directly to Motion are only integrated while the entity is still in the set
+void set_velocity(Entity entity, vec2 velocity);
+
+// A wall tile or body crossed by a ray, see PhysicsSystem::raycast
+struct RaycastHit
+{
+	Entity entity = Entity(0); // the wall tile's null entity, also keeps 'RaycastHit hit;' from allocating an entity
+	vec2 point;		 // where the ray enters the box
+	vec2 normal;	 // side of the box the ray enters through, zero if the ray starts inside
+	float distance;
+};
+
 // A simple physics system that moves rigid bodies and checks for collision
 class PhysicsSystem
 {
 public:
 	void step(float elapsed_ms);
 
+	// Ray and segment queries against the wall tiles and the bodies whose layer is in the mask (see layer_bit()).
+	// The cells crossed by the ray are walked in order, so the cost depends on the length of the ray, not on the
+	// number of bodies. Bodies are looked up in the broad phase grids of the last step; a body created since is not found.
+	// Returns the closest hit within max_distance of the origin, direction does not need to be normalized
+	bool raycast(vec2 origin, vec2 direction, float max_distance, unsigned int mask, RaycastHit &hit);
+	// Fills hits with every wall tile and body crossed between start and end, closest first
+	void segment_query(vec2 start, vec2 end, unsigned int mask, std::vector<RaycastHit> &hits);
+	// True if no wall tile lies between the two points
+	bool line_of_sight(vec2 start, vec2 end);
+
+	// Number of narrow phase tests in the last step, for profiling the broad phase
+	unsigned int pair_tests = 0;
+	// Time of the broad and narrow phase in the last step, without the contact solver
+	float collision_detection_us = 0.f;
+	// Number of motions integrated in the last step, i.e. the size of the active set
+	unsigned int integrated_count = 0;
+
 	PhysicsSystem()
 	{
 	}
+
+private:
+	// Broad phase grids: static_grid holds indices into static_entities, dynamic_grid holds physicsBodies indices
+	SpatialGrid static_grid;
+	SpatialGrid dynamic_grid;
+	std::vector<Entity> static_entities;
+	// The entity of each physicsBodies index in dynamic_grid, to check that a query does not find a removed body
+	std::vector<Entity> dynamic_entities;
+	std::vector<unsigned int> query_items;
+	std::vector<unsigned int> candidates;
+
+	// Statics are re-binned only when they changed, moving bodies every step
+	void update_static_grid();
+	void update_dynamic_grid();
+	// Moves bodies that travelled far in this step back to their first contact with a wall, static body or the player
+	void sweep_fast_bodies(float step_seconds);
+	// Fills 'candidates' with the sorted, unique items of the grid cells overlapped by the box
+	void query_candidates(const SpatialGrid &grid, vec2 box_min, vec2 box_max);
+	// Calls on_hit for the wall tile and every body in the mask that the ray crosses in cell (x, y)
+	template <typename OnHit>
+	void raycast_cell(int x, int y, vec2 origin, vec2 direction, unsigned int mask, OnHit on_hit);
+
+	// Two solid bodies in or near contact, separated by solve_contacts() after all pairs were tested
+	struct SolverContact
+	{
+		// initialized, a default constructed Entity would allocate a new entity
+		Entity entity_a = Entity(0);
+		Entity entity_b = Entity(0); // Entity(0) for a wall tile
+		Motion *motion_a;
+		Motion *motion_b; // nullptr for a wall tile
+		vec2 wall_center;
+		vec2 normal;		// from a to b, fixed when the contact is found
+		float share_a;	// part of the overlap that moves a, by inverse mass
+		float share_b;
+		unsigned int color; // contacts of the same color share no movable body
+	};
+	static const unsigned int MAX_SOLVER_COLORS = 64;
+	std::vector<SolverContact> solver_contacts;
+	// Per motion (index in registry.motions), a bit for every color one of its contacts has
+	std::vector<uint64_t> used_colors;
+
+	void add_solver_contact(Entity entity_a, const PhysicsBody &body_a, Motion &motion_a, Entity entity_b, const PhysicsBody &body_b, Motion &motion_b);
+	// Resolves the overlaps of all solid contacts of this step with a few relaxation iterations
+	void solve_contacts();
 };
\ No newline at end of file
@@ -51,7 +51,8 @@ BoneTransform interpolate_bone_transform(const BoneTransform &a, const BoneTrans
 
 void RenderSystem::drawTexturedMesh(Entity entity, const mat3 &view, const mat3 &projection)
 {
-	Motion &motion = registry.motions.get(entity);
+	Motion motion = registry.motions.get(entity);
+	motion.position = get_interpolated_position(entity, motion);
 	// Transformation code, see Rendering and Transformation in the template
 	// specification for more info Incrementally updates transformation matrix,
 	// thus ORDER IS IMPORTANT
@@ -582,10 +583,67 @@ mat3 RenderSystem::createProjectionMatrix()
 mat3 RenderSystem::createCameraViewMatrix()
 {
 	Transform transform;
-	transform.translate(camera_position * -1.f);
+	transform.translate(mix(previous_camera_position, camera_position, interpolation_alpha) * -1.f);
 	return transform.mat;
 }
 
+void RenderSystem::save_previous_tick()
+{
+	// not only the moving set: the solver pushes bodies at rest, and some positions are set directly
+	for (Motion &motion : registry.motions.components)
+	{
+		motion.previous_position = motion.position;
+		motion.has_previous_position = true;
+	}
+	previous_camera_position = camera_position;
+}
+
+void RenderSystem::snap_previous_tick()
+{
+	for (Motion &motion : registry.motions.components)
+		motion.previous_position = motion.position;
+	previous_camera_position = camera_position;
+}
+
+void RenderSystem::snap_previous_tick(Entity entity)
+{
+	Motion &motion = registry.motions.get(entity);
+	motion.previous_position = motion.position;
+}
+
+// Entities attached to an owner are placed from it once per tick, some before and some after the owner moved.
+// They are drawn at their offset from where the owner is drawn, so they do not jitter against it.
+vec2 RenderSystem::get_interpolated_position(Entity entity, const Motion &motion)
+{
+	Entity owner = Entity(0);
+	vec2 offset = {0.f, 0.f};
+	if (registry.weapons.has(entity) && registry.players.size() > 0 && registry.players.components[0].weapon == entity)
+	{
+		owner = registry.players.entities[0];
+		offset = registry.players.components[0].weapon_offset;
+	}
+	else if (registry.damageAreas.has(entity) && registry.damageAreas.get(entity).relative_position)
+	{
+		owner = registry.damageAreas.get(entity).owner;
+		offset = registry.damageAreas.get(entity).offset_from_owner;
+	}
+	else if (registry.healthbar.has(entity) && !registry.cameraUI.has(entity))
+	{
+		owner = registry.healthbar.get(entity).owner;
+		offset = registry.healthbar.get(entity).offset_from_owner;
+	}
+
+	auto interpolate = [this](const Motion &m)
+	{
+		return m.has_previous_position ? mix(m.previous_position, m.position, interpolation_alpha) : m.position;
+	};
+	if (owner != 0 && registry.motions.has(owner))
+	{
+		return interpolate(registry.motions.get(owner)) + offset;
+	}
+	return interpolate(motion);
+}
+
 // boilerplate code generated with the help of gpt
 // and https://learnopengl.com/code_viewer_gh.php?code=src/7.in_practice/2.text_rendering/text_rendering.cpp
 void RenderSystem::renderText(const std::string &text, float x, float y, float scale, vec3 color)
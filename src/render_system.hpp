@@ -207,9 +207,19 @@ public:
 
 	vec2 camera_position = {0.f, 0.f};
 
+	// Remembers the positions at the start of a simulation tick, frames are drawn in between two ticks
+	void save_previous_tick();
+	// After a level load or a teleport, so the next frames do not sweep across the jump
+	void snap_previous_tick();
+	void snap_previous_tick(Entity entity); // only the entity, e.g. a teleport that leaves the others moving
+	// How far the drawn frame is from the previous tick (0) to the current one (1)
+	float interpolation_alpha = 1.f;
+	vec2 previous_camera_position = {0.f, 0.f};
+
 private:
 	// Internal drawing functions for each entity type
 	void drawTexturedMesh(Entity entity, const mat3 &view, const mat3 &projection);
+	vec2 get_interpolated_position(Entity entity, const Motion &motion);
 	void drawToScreen();
 
 	// Window handle
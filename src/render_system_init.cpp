@@ -971,6 +971,7 @@ RenderSystem::~RenderSystem()
 bool RenderSystem::initScreenTexture()
 {
 	registry.screenStates.emplace(screen_state_entity);
+	registry.set_scope(screen_state_entity, Scope::PERSISTENT);
 
 	int framebuffer_width, framebuffer_height;
 	glfwGetFramebufferSize(const_cast<GLFWwindow *>(window), &framebuffer_width, &framebuffer_height); // Note, this will be 2x the resolution given to glfwCreateWindow on retina displays
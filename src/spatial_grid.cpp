@@ -0,0 +1,72 @@
+// internal
+#include "spatial_grid.hpp"
+
+#include <algorithm>
+
+void SpatialGrid::resize(int width, int height)
+{
+	this->width = std::max(width, 1);
+	this->height = std::max(height, 1);
+	clear();
+	build();
+}
+
+void SpatialGrid::clear()
+{
+	pending.clear();
+}
+
+void SpatialGrid::cell_range(vec2 box_min, vec2 box_max, int &x0, int &y0, int &x1, int &y1) const
+{
+	x0 = std::min(std::max((int)floor(box_min.x / TILE_SCALE), 0), width - 1);
+	y0 = std::min(std::max((int)floor(box_min.y / TILE_SCALE), 0), height - 1);
+	x1 = std::min(std::max((int)floor(box_max.x / TILE_SCALE), 0), width - 1);
+	y1 = std::min(std::max((int)floor(box_max.y / TILE_SCALE), 0), height - 1);
+}
+
+void SpatialGrid::add(unsigned int item, vec2 box_min, vec2 box_max)
+{
+	int x0, y0, x1, y1;
+	cell_range(box_min, box_max, x0, y0, x1, y1);
+	for (int x = x0; x <= x1; x++)
+		for (int y = y0; y <= y1; y++)
+			pending.push_back({(unsigned int)(y * width + x), item});
+}
+
+void SpatialGrid::build()
+{
+	// counting sort of the pending items by cell
+	cell_start.assign(width * height + 1, 0);
+	for (auto &cell_item : pending)
+		cell_start[cell_item.first + 1]++;
+	for (unsigned int c = 0; c < cell_start.size() - 1; c++)
+		cell_start[c + 1] += cell_start[c];
+
+	items.resize(pending.size());
+	std::vector<unsigned int> &next = scratch;
+	next.assign(cell_start.begin(), cell_start.end() - 1);
+	for (auto &cell_item : pending)
+		items[next[cell_item.first]++] = cell_item.second;
+}
+
+void SpatialGrid::query(vec2 box_min, vec2 box_max, std::vector<unsigned int> &result) const
+{
+	int x0, y0, x1, y1;
+	cell_range(box_min, box_max, x0, y0, x1, y1);
+	for (int y = y0; y <= y1; y++)
+	{
+		unsigned int row = y * width;
+		result.insert(result.end(), items.begin() + cell_start[row + x0], items.begin() + cell_start[row + x1 + 1]);
+	}
+}
+
+void SpatialGrid::query_cell(int x, int y, std::vector<unsigned int> &result) const
+{
+	// not built yet
+	if (cell_start.empty())
+		return;
+	x = std::min(std::max(x, 0), width - 1);
+	y = std::min(std::max(y, 0), height - 1);
+	unsigned int c = y * width + x;
+	result.insert(result.end(), items.begin() + cell_start[c], items.begin() + cell_start[c + 1]);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include "common.hpp"
+
+// A uniform grid of TILE_SCALE sized cells over the level, used as a broad phase
+// Items are small integers (e.g. container indices) that are binned into every cell their box overlaps.
+// The grid is filled in bulk: clear(), add() all items, then build() sorts them by cell with a counting
+// sort, so the items of a cell are one contiguous range and no per-cell vectors are allocated.
+class SpatialGrid
+{
+public:
+	// The cells cover [0, width * TILE_SCALE) x [0, height * TILE_SCALE), boxes outside are clamped to the border cells
+	void resize(int width, int height);
+	int get_width() const { return width; }
+	int get_height() const { return height; }
+
+	void clear();
+	void add(unsigned int item, vec2 box_min, vec2 box_max);
+	void build();
+
+	// Appends the items of all cells overlapped by the box, an item spanning several cells is reported once per cell
+	void query(vec2 box_min, vec2 box_max, std::vector<unsigned int> &result) const;
+	// Appends the items of one cell, cells outside of the grid are clamped to the border like boxes
+	void query_cell(int x, int y, std::vector<unsigned int> &result) const;
+
+private:
+	int width = 1;
+	int height = 1;
+
+	// (cell, item) pairs added since the last clear()
+	std::vector<std::pair<unsigned int, unsigned int>> pending;
+	// items of cell c are items[cell_start[c]] .. items[cell_start[c + 1] - 1]
+	std::vector<unsigned int> cell_start;
+	std::vector<unsigned int> items;
+	std::vector<unsigned int> scratch;
+
+	void cell_range(vec2 box_min, vec2 box_max, int &x0, int &y0, int &x1, int &y1) const;
+};
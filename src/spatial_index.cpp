@@ -0,0 +1,111 @@
+// internal
+#include "spatial_index.hpp"
+#include "tiny_ecs_registry.hpp"
+
+SpatialIndex spatial_index;
+
+void SpatialIndex::reset(int width, int height)
+{
+	this->width = std::max((width + CELL_TILES - 1) / CELL_TILES, 1);
+	this->height = std::max((height + CELL_TILES - 1) / CELL_TILES, 1);
+	records.clear();
+	cells.assign(this->width * this->height, std::vector<unsigned int>());
+}
+
+void SpatialIndex::cell_coordinates(vec2 position, int &x, int &y) const
+{
+	const float cell_size = CELL_TILES * TILE_SCALE;
+	x = std::min(std::max((int)floor(position.x / cell_size), 0), width - 1);
+	y = std::min(std::max((int)floor(position.y / cell_size), 0), height - 1);
+}
+
+int SpatialIndex::cell_of(vec2 position) const
+{
+	int x, y;
+	cell_coordinates(position, x, y);
+	return y * width + x;
+}
+
+void SpatialIndex::insert(Entity entity)
+{
+	vec2 position = registry.motions.get(entity).position;
+	int cell = cell_of(position);
+	cells[cell].push_back((unsigned int)records.size());
+	records.push_back({entity, position, cell});
+}
+
+void SpatialIndex::remove_from_cell(unsigned int record)
+{
+	std::vector<unsigned int> &cell = cells[records[record].cell];
+	*std::find(cell.begin(), cell.end(), record) = cell.back();
+	cell.pop_back();
+}
+
+void SpatialIndex::update()
+{
+	for (unsigned int r = 0; r < records.size();)
+	{
+		Record &record = records[r];
+		if (!registry.motions.has(record.entity))
+		{
+			// the last record takes the place of the removed one
+			remove_from_cell(r);
+			unsigned int last = (unsigned int)records.size() - 1;
+			if (r != last)
+			{
+				std::vector<unsigned int> &cell = cells[records[last].cell];
+				*std::find(cell.begin(), cell.end(), last) = r;
+				records[r] = records[last];
+			}
+			records.pop_back();
+			continue;
+		}
+		record.position = registry.motions.get(record.entity).position;
+		int cell = cell_of(record.position);
+		if (cell != record.cell)
+		{
+			remove_from_cell(r);
+			record.cell = cell;
+			cells[cell].push_back(r);
+		}
+		r++;
+	}
+}
+
+void SpatialIndex::query_aabb(vec2 box_min, vec2 box_max, std::vector<Entity> &result) const
+{
+	int x0, y0, x1, y1;
+	cell_coordinates(box_min, x0, y0);
+	cell_coordinates(box_max, x1, y1);
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			for (unsigned int r : cells[y * width + x])
+			{
+				const Record &record = records[r];
+				if (record.position.x >= box_min.x && record.position.x <= box_max.x && record.position.y >= box_min.y && record.position.y <= box_max.y)
+					result.push_back(record.entity);
+			}
+		}
+	}
+}
+
+void SpatialIndex::query_radius(vec2 center, float radius, std::vector<Entity> &result) const
+{
+	int x0, y0, x1, y1;
+	cell_coordinates(center - radius, x0, y0);
+	cell_coordinates(center + radius, x1, y1);
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			for (unsigned int r : cells[y * width + x])
+			{
+				const Record &record = records[r];
+				if (length(record.position - center) <= radius)
+					result.push_back(record.entity);
+			}
+		}
+	}
+}
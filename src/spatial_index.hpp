@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "common.hpp"
+#include "tiny_ecs.hpp"
+
+// Positions of the gameplay entities that are looked up by distance (enemies, fountains, treasure boxes),
+// binned into a grid of CELL_TILES x CELL_TILES tiles so that radius, box and nearest queries only visit
+// the cells around the query instead of scanning the containers.
+// Entities are added with insert() when they are created; update() re-bins the ones whose Motion moved
+// to another cell and drops the ones that lost their Motion (see PhysicsSystem::step).
+class SpatialIndex
+{
+public:
+	static const int CELL_TILES = 4;
+
+	// Removes all entities, the index covers width x height tiles; positions outside are clamped to the border cells
+	void reset(int width, int height);
+	// Adds an entity that has a Motion at the current position of the Motion
+	void insert(Entity entity);
+	void update();
+
+	// Appends the entities whose position is within radius of center / inside the box
+	void query_radius(vec2 center, float radius, std::vector<Entity> &result) const;
+	void query_aabb(vec2 box_min, vec2 box_max, std::vector<Entity> &result) const;
+
+	// The closest entity within max_distance for which filter(entity) is true, Entity(0) if there is none
+	// The cells are searched in rings around the position, a ring is only visited if it can hold a closer entity
+	template <typename Filter>
+	Entity nearest(vec2 position, float max_distance, Filter filter) const;
+
+	size_t size() const { return records.size(); }
+
+private:
+	struct Record
+	{
+		Entity entity;
+		vec2 position;
+		int cell;
+	};
+
+	int width = 1;	// in cells
+	int height = 1;
+	std::vector<Record> records;
+	// indices into records, per cell
+	std::vector<std::vector<unsigned int>> cells = std::vector<std::vector<unsigned int>>(1);
+
+	int cell_of(vec2 position) const;
+	void cell_coordinates(vec2 position, int &x, int &y) const;
+	void remove_from_cell(unsigned int record);
+};
+
+extern SpatialIndex spatial_index;
+
+template <typename Filter>
+Entity SpatialIndex::nearest(vec2 position, float max_distance, Filter filter) const
+{
+	const float cell_size = CELL_TILES * TILE_SCALE;
+	Entity best = Entity(0);
+	float best_distance = max_distance;
+	int x, y;
+	cell_coordinates(position, x, y);
+	int max_ring = std::max(width, height);
+	for (int ring = 0; ring <= max_ring; ring++)
+	{
+		// every entity in this ring is at least (ring - 1) cells away
+		if (ring > 0 && (ring - 1) * cell_size > best_distance)
+			break;
+		for (int cy = y - ring; cy <= y + ring; cy++)
+		{
+			if (cy < 0 || cy >= height)
+				continue;
+			// the inner cells of the ring were visited before
+			int step = (cy == y - ring || cy == y + ring) ? 1 : 2 * ring;
+			for (int cx = x - ring; cx <= x + ring; cx += std::max(step, 1))
+			{
+				if (cx < 0 || cx >= width)
+					continue;
+				for (unsigned int r : cells[cy * width + cx])
+				{
+					const Record &record = records[r];
+					float distance = length(record.position - position);
+					if (distance <= best_distance && filter(record.entity))
+					{
+						best = record.entity;
+						best_distance = distance;
+					}
+				}
+			}
+		}
+	}
+	return best;
+}
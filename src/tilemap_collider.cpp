@@ -0,0 +1,33 @@
+// internal
+#include "tilemap_collider.hpp"
+
+#include <algorithm>
+
+TilemapCollider wall_tiles;
+
+void TilemapCollider::reset(int width, int height)
+{
+	this->width = std::max(width, 0);
+	this->height = std::max(height, 0);
+	solid.assign(this->width * this->height, false);
+}
+
+void TilemapCollider::set_solid(int x, int y)
+{
+	if (x >= 0 && y >= 0 && x < width && y < height)
+		solid[y * width + x] = true;
+}
+
+bool TilemapCollider::is_solid(int x, int y) const
+{
+	return x >= 0 && y >= 0 && x < width && y < height && solid[y * width + x];
+}
+
+void TilemapCollider::tile_range(vec2 box_min, vec2 box_max, int &x0, int &y0, int &x1, int &y1) const
+{
+	// a tile touching the box at its edge still counts, like in the AABB test of the physics system
+	x0 = std::max((int)ceil(box_min.x / TILE_SCALE) - 1, 0);
+	y0 = std::max((int)ceil(box_min.y / TILE_SCALE) - 1, 0);
+	x1 = std::min((int)floor(box_max.x / TILE_SCALE), width - 1);
+	y1 = std::min((int)floor(box_max.y / TILE_SCALE), height - 1);
+}
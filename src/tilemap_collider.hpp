@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+#include "common.hpp"
+
+// The wall tiles of the current level as a solid/free bitmap of TILE_SCALE sized tiles.
+// Walls have no physics body; the physics system resolves moving bodies against the tiles their box overlaps.
+// Collisions with a wall tile are reported with the null entity Entity(0) as the 'other' entity.
+class TilemapCollider
+{
+public:
+	// Makes all width x height tiles free
+	void reset(int width, int height);
+	void set_solid(int x, int y);
+	// Tiles outside of the level are free, as there were never walls there
+	bool is_solid(int x, int y) const;
+
+	int get_width() const { return width; }
+	int get_height() const { return height; }
+
+	// Range of tiles overlapped by the box, touching tiles included; clamped to the level, empty if x0 > x1 or y0 > y1
+	void tile_range(vec2 box_min, vec2 box_max, int &x0, int &y0, int &x1, int &y1) const;
+
+private:
+	int width = 0;
+	int height = 0;
+	std::vector<bool> solid; // solid[y * width + x]
+};
+
+extern TilemapCollider wall_tiles;
@@ -2,4 +2,43 @@
 #include "tiny_ecs.hpp"
 
 // All we need to store besides the containers is the id of every entity and callbacks to be able to remove entities across containers
-unsigned int Entity::id_count = 1;
\ No newline at end of file
+unsigned int Entity::id_count = 1;
+
+const unsigned int Entity::INDEX_BITS;
+const unsigned int Entity::INDEX_MASK;
+const unsigned int Entity::GENERATION_MASK;
+const unsigned int Entity::MIN_FREE_INDICES;
+
+// Function-local static, since entities may already be created during static initialization of other files
+std::deque<unsigned int> &Entity::free_indices()
+{
+	static std::deque<unsigned int> free_indices;
+	return free_indices;
+}
+
+Entity::Entity()
+{
+	unsigned int index;
+	if (free_indices().size() > MIN_FREE_INDICES)
+	{
+		index = free_indices().front();
+		free_indices().pop_front();
+	}
+	else
+	{
+		index = id_count++;
+		assert(index <= INDEX_MASK && "Too many entities alive at the same time");
+		generations().push_back(0);
+	}
+	id = (generations()[index] << INDEX_BITS) | index;
+}
+
+void Entity::destroy(Entity e)
+{
+	if (!e.is_alive())
+		return;
+	// Note, the generation still wraps around after GENERATION_MASK re-uses of the same index
+	unsigned int i = e.index();
+	generations()[i] = (generations()[i] + 1) & GENERATION_MASK;
+	free_indices().push_back(i);
+}
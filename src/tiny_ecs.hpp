@@ -2,49 +2,150 @@
 
 #include <algorithm>
 #include <vector>
+#include <deque>
 #include <unordered_map>
 #include <set>
 #include <functional>
 #include <typeindex>
+#include <tuple>
+#include <bitset>
+#include <type_traits>
+#include <typeinfo>
+#include <cstdio>
 #include <assert.h>
 
 // Unique identifyer for all entities
+// The id packs the index of the entity (low bits) with a generation counter (high bits).
+// Destroying an entity bumps the generation of its index and puts the index on a free list,
+// so indices are re-used while old handles to the destroyed entity can be detected via is_alive().
+// The free list is first in, first out and only handed out once it holds MIN_FREE_INDICES, so an index is re-used
+// at most once every MIN_FREE_INDICES destroys and its generation wraps around only after millions of them.
 class Entity
 {
 	unsigned int id;
-	static unsigned int id_count; // starts from 1, entit 0 is the default initialization
-public:
-	Entity()
+	static unsigned int id_count;										 // next never used index, starts from 1, entity 0 is the default initialization
+	// Current generation of every index, a function-local static since entities may already be
+	// created during static initialization of other files
+	static std::vector<unsigned int> &generations()
 	{
-		id = id_count++;
-		// Note, indices of already deleted entities arent re-used in this simple implementation.
+		static std::vector<unsigned int> generations(1, 0); // index 0 is reserved for the default initialization
+		return generations;
 	}
+	static std::deque<unsigned int> &free_indices(); // indices of destroyed entities, oldest first
+public:
+	static const unsigned int INDEX_BITS = 20; // ~1M simultaneously alive entities, 4096 generations per index
+	static const unsigned int INDEX_MASK = (1u << INDEX_BITS) - 1;
+	static const unsigned int GENERATION_MASK = ~0u >> INDEX_BITS;
+	static const unsigned int MIN_FREE_INDICES = 1024;
+
+	Entity(); // creates a new entity, re-using the index of a destroyed one if possible
 	Entity(unsigned int id) : id(id) {}
-	operator unsigned int() { return id; } // this enables automatic casting to int
+	operator unsigned int() const { return id; } // this enables automatic casting to int
 	bool operator<(const Entity &other) const
 	{
 		return id < other.id;
 	}
+
+	unsigned int index() const { return id & INDEX_MASK; }
+	unsigned int generation() const { return id >> INDEX_BITS; }
+
+	// False for Entity(0) and for handles to entities that have been destroyed
+	bool is_alive() const
+	{
+		unsigned int i = index();
+		return i != 0 && i < generations().size() && generations()[i] == generation();
+	}
+
+	// Invalidates all handles to e and recycles its index; destroying a dead handle does nothing.
+	// Note, this does not remove the components, see ECSRegistry::remove_all_components_of
+	static void destroy(Entity e);
+};
+
+// One bit per component container, set if the entity owns a component of that type
+const unsigned int MAX_COMPONENT_TYPES = 64;
+typedef std::bitset<MAX_COMPONENT_TYPES> Signature;
+
+// Lifetime of an entity, all entities of a scope can be released at once, see Registry::release_scope
+enum class Scope : unsigned char
+{
+	PERSISTENT, // only removed explicitly, e.g. the screen state
+	LEVEL,			// the default, released when a level is (re)loaded
+	FRAME				// released at the beginning of the next step, e.g. debug lines
 };
 
-// Common interface to refer to all containers in the ECS registry
-struct ContainerInterface
+// Keeps the entity signatures of the owning registry up to date, shared by all container kinds
+class SignatureLink
 {
-	virtual void clear() = 0;
-	virtual size_t size() = 0;
-	virtual void remove(Entity e) = 0;
-	virtual bool has(Entity entity) = 0;
+	// Set by the registry: the per-entity-index signatures and the bit of this component type
+	std::vector<Signature> *signatures = nullptr;
+	unsigned int signature_bit = 0;
+
+protected:
+	void set_signature_bit(Entity e, bool value)
+	{
+		if (signatures == nullptr)
+			return;
+		if (e.index() >= signatures->size())
+			signatures->resize(e.index() + 1);
+		(*signatures)[e.index()].set(signature_bit, value);
+	}
+
+	// Clears the bit of this container and returns true if the entity has no other components left
+	bool clear_signature_bit(Entity e)
+	{
+		if (signatures == nullptr)
+			return true;
+		Signature &signature = (*signatures)[e.index()];
+		signature.reset(signature_bit);
+		return signature.none();
+	}
+
+public:
+	// Called once by the registry that owns this container
+	void connect(std::vector<Signature> *registry_signatures, unsigned int bit)
+	{
+		signatures = registry_signatures;
+		signature_bit = bit;
+	}
 };
 
 // A container that stores components of type 'Component' and associated entities
+// Implemented as a sparse set: a paged sparse array maps an entity index to the index of its
+// component in the densely packed 'components'/'entities' arrays, so has() and get() are
+// one or two array loads instead of a hash lookup. The dense entity is compared against the
+// full handle, so a stale handle whose index got recycled is not mistaken for the new entity.
 template <typename Component> // A component can be any class
-class ComponentContainer : public ContainerInterface
+class ComponentContainer : public SignatureLink
 {
 private:
-	// The hash map from Entity -> array index.
-	std::unordered_map<unsigned int, unsigned int> map_entity_componentID; // the entity is cast to uint to be hashable.
+	// Sparse pages are only allocated for index ranges that are actually used
+	static const unsigned int SPARSE_PAGE_SIZE = 4096;
+	static const unsigned int INVALID_INDEX = ~0u;
+
+	// The paged sparse array from Entity::index() -> array index (an empty page holds no entities)
+	std::vector<std::vector<unsigned int>> sparse_pages;
 	bool registered = false;
 
+	// Returns the sparse slot of an entity index, or nullptr if its page was never allocated
+	unsigned int *find_slot(unsigned int index)
+	{
+		unsigned int page = index / SPARSE_PAGE_SIZE;
+		if (page >= sparse_pages.size() || sparse_pages[page].empty())
+			return nullptr;
+		return &sparse_pages[page][index % SPARSE_PAGE_SIZE];
+	}
+
+	// Returns the sparse slot of an entity index, allocating its page if necessary
+	unsigned int &assure_slot(unsigned int index)
+	{
+		unsigned int page = index / SPARSE_PAGE_SIZE;
+		if (page >= sparse_pages.size())
+			sparse_pages.resize(page + 1);
+		if (sparse_pages[page].empty())
+			sparse_pages[page].assign(SPARSE_PAGE_SIZE, INVALID_INDEX);
+		return sparse_pages[page][index % SPARSE_PAGE_SIZE];
+	}
+
 public:
 	// Container of all components of type 'Component'
 	std::vector<Component> components;
@@ -63,7 +164,8 @@ public:
 		// Usually, every entity should only have one instance of each component type
 		assert(!(check_for_duplicates && has(e)) && "Entity already contained in ECS registry");
 
-		map_entity_componentID[e] = (unsigned int)components.size();
+		assure_slot(e.index()) = (unsigned int)components.size();
+		set_signature_bit(e, true);
 		components.push_back(std::move(c)); // the move enforces move instead of copy constructor
 		entities.push_back(e);
 		return components.back();
@@ -85,13 +187,14 @@ public:
 	Component &get(Entity e)
 	{
 		assert(has(e) && "Entity not contained in ECS registry");
-		return components[map_entity_componentID[e]];
+		return components[*find_slot(e.index())];
 	}
 
 	// Check if entity has a component of type 'Component'
 	bool has(Entity entity)
 	{
-		return map_entity_componentID.count(entity) > 0;
+		unsigned int *slot = find_slot(entity.index());
+		return slot != nullptr && *slot != INVALID_INDEX && (unsigned int)entities[*slot] == (unsigned int)entity;
 	}
 
 	// Remove an component and pack the container to re-use the empty space
@@ -99,31 +202,66 @@ public:
 	{
 		if (has(e))
 		{
+			unsigned int *slot = find_slot(e.index());
 			// Get the current position
-			int cID = map_entity_componentID[e];
+			unsigned int cID = *slot;
 
 			// Move the last element to position cID using the move operator
 			// Note, components[cID] = components.back() would trigger the copy instead of move operator
 			components[cID] = std::move(components.back());
 			entities[cID] = entities.back(); // the entity is only a single index, copy it.
-			map_entity_componentID[entities.back()] = cID;
+			*find_slot(entities.back().index()) = cID;
 
 			// Erase the old component and free its memory
-			map_entity_componentID.erase(e);
+			*slot = INVALID_INDEX;
+			set_signature_bit(e, false);
 			components.pop_back();
 			entities.pop_back();
-			// Note, one could mark the id for re-use
 		}
 	};
 
 	// Remove all components of type 'Component'
 	void clear()
 	{
-		map_entity_componentID.clear();
+		// Reset only the used slots; the sparse pages are kept for re-use
+		for (Entity e : entities)
+		{
+			*find_slot(e.index()) = INVALID_INDEX;
+			set_signature_bit(e, false);
+		}
 		components.clear();
 		entities.clear();
 	}
 
+	// Remove the components of all entities matching 'pred' in one compaction pass, the remaining
+	// components keep their order. Entities that are left without any component are appended to 'removed'.
+	// Note, the vectors keep their capacity, so the memory is re-used by the next level or frame
+	template <typename Predicate>
+	void remove_if(Predicate pred, std::vector<Entity> &removed)
+	{
+		unsigned int kept = 0;
+		for (unsigned int i = 0; i < entities.size(); i++)
+		{
+			Entity e = entities[i];
+			if (pred(e))
+			{
+				*find_slot(e.index()) = INVALID_INDEX;
+				if (clear_signature_bit(e))
+					removed.push_back(e);
+				continue;
+			}
+			if (kept != i)
+			{
+				components[kept] = std::move(components[i]);
+				entities[kept] = e;
+			}
+			*find_slot(e.index()) = kept;
+			kept++;
+		}
+		components.erase(components.begin() + kept, components.end());
+		entities.erase(entities.begin() + kept, entities.end());
+	}
+
 	// Report the number of components of type 'Component'
 	size_t size()
 	{
@@ -140,10 +278,390 @@ public:
 		std::vector<Component> components_new;
 		components_new.reserve(components.size());
 		std::transform(entities.begin(), entities.end(), std::back_inserter(components_new), [&](Entity e)
-									 { return std::move(get(e)); }); // note, the get still uses the old hash map (on purpose!)
+									 { return std::move(components[*find_slot(e.index())]); }); // note, this still uses the old sparse indices (on purpose!)
 		components = std::move(components_new);				 // note, we use move operations to not create unneccesary copies of objects, but memory is still allocated for the new vector
-		// Fill the new hashmap
+		// Fill the new sparse indices
+		for (unsigned int i = 0; i < entities.size(); i++)
+			*find_slot(entities[i].index()) = i;
+	}
+};
+
+// A container for empty marker components ('tags') such as DebugComponent
+// Only one bit per entity index and the list of tagged entities are stored, there is no component
+// payload and no sparse index array. has() is a bit test plus the liveness check of the handle.
+// Removing a tag searches the entity list from the back, which is cheap for the usual
+// "remove the last one until empty" loops.
+template <typename Tag>
+class TagContainer : public SignatureLink
+{
+	static_assert(std::is_empty<Tag>::value, "Only empty structs can be stored as tags");
+
+	std::vector<bool> bits;
+
+public:
+	// The tagged entities
+	std::vector<Entity> entities;
+
+	// All tags are the same, get() returns this shared instance to stay compatible with ComponentContainer
+	Tag &insert(Entity e, Tag = Tag(), bool check_for_duplicates = true)
+	{
+		assert(!(check_for_duplicates && has(e)) && "Entity already contained in ECS registry");
+		if (e.index() >= bits.size())
+			bits.resize(e.index() + 1, false);
+		if (!bits[e.index()])
+		{
+			bits[e.index()] = true;
+			entities.push_back(e);
+			set_signature_bit(e, true);
+		}
+		return shared_tag();
+	}
+
+	template <typename... Args>
+	Tag &emplace(Entity e, Args &&...)
+	{
+		return insert(e);
+	}
+
+	Tag &get(Entity e)
+	{
+		assert(has(e) && "Entity not contained in ECS registry");
+		return shared_tag();
+	}
+
+	bool has(Entity e)
+	{
+		return e.index() < bits.size() && bits[e.index()] && e.is_alive();
+	}
+
+	void remove(Entity e)
+	{
+		if (!has(e))
+			return;
+		for (size_t i = entities.size(); i-- > 0;)
+		{
+			if ((unsigned int)entities[i] == (unsigned int)e)
+			{
+				entities[i] = entities.back();
+				entities.pop_back();
+				break;
+			}
+		}
+		bits[e.index()] = false;
+		set_signature_bit(e, false);
+	}
+
+	void clear()
+	{
+		for (Entity e : entities)
+		{
+			bits[e.index()] = false;
+			set_signature_bit(e, false);
+		}
+		entities.clear();
+	}
+
+	// See ComponentContainer::remove_if
+	template <typename Predicate>
+	void remove_if(Predicate pred, std::vector<Entity> &removed)
+	{
+		unsigned int kept = 0;
 		for (unsigned int i = 0; i < entities.size(); i++)
-			map_entity_componentID[entities[i]] = i;
+		{
+			Entity e = entities[i];
+			if (pred(e))
+			{
+				bits[e.index()] = false;
+				if (clear_signature_bit(e))
+					removed.push_back(e);
+				continue;
+			}
+			entities[kept++] = e;
+		}
+		entities.erase(entities.begin() + kept, entities.end());
+	}
+
+	size_t size()
+	{
+		return entities.size();
+	}
+
+private:
+	static Tag &shared_tag()
+	{
+		static Tag tag;
+		return tag;
+	}
+};
+
+// The container used for a component type, empty structs are stored as tags
+template <typename Component>
+using container_for = typename std::conditional<std::is_empty<Component>::value, TagContainer<Component>, ComponentContainer<Component>>::type;
+
+// Marks the component types a view should skip, e.g. registry.view<Enemy, Motion>(exclude<Chef, King>)
+template <typename... Excluded>
+struct exclude_t
+{
+};
+template <typename... Excluded>
+constexpr exclude_t<Excluded...> exclude{};
+
+// Iterates all entities that have every 'Included' component and none of the 'Excluded' ones.
+// The walk is driven by the smallest included container, all other containers are only probed.
+// Components can be added while iterating (new entities are not visited), but do not remove
+// components of the included types since the driving container is packed on removal.
+template <typename Include, typename Exclude>
+class View;
+
+template <typename... Included, typename... Excluded>
+class View<std::tuple<Included...>, std::tuple<Excluded...>>
+{
+	std::tuple<container_for<Included> *...> included;
+	std::tuple<container_for<Excluded> *...> excluded;
+	std::vector<Entity> *driver = nullptr; // entities of the smallest included container
+
+	void consider_driver(std::vector<Entity> &entities)
+	{
+		if (driver == nullptr || entities.size() < driver->size())
+			driver = &entities;
+	}
+
+public:
+	View(container_for<Included> &...included_containers, container_for<Excluded> &...excluded_containers)
+			: included(&included_containers...), excluded(&excluded_containers...)
+	{
+		using expand = int[]; // C++14 idiom to run an expression for every type of a parameter pack
+		(void)expand{0, (consider_driver(included_containers.entities), 0)...};
+	}
+
+	// Check if an entity of the driving container passes all other filters of this view
+	bool accepts(Entity e)
+	{
+		bool result = true;
+		using expand = int[];
+		(void)expand{0, (result = result && (&std::get<container_for<Included> *>(included)->entities == driver || std::get<container_for<Included> *>(included)->has(e)), 0)...};
+		(void)expand{0, (result = result && !std::get<container_for<Excluded> *>(excluded)->has(e), 0)...};
+		return result;
+	}
+
+	// Check if any entity, not only one of the driving container (e.g. one found by a spatial query), is in this view
+	bool contains(Entity e)
+	{
+		bool result = true;
+		using expand = int[];
+		(void)expand{0, (result = result && std::get<container_for<Included> *>(included)->has(e), 0)...};
+		(void)expand{0, (result = result && !std::get<container_for<Excluded> *>(excluded)->has(e), 0)...};
+		return result;
+	}
+
+	// Direct access to an included component of an entity of this view
+	template <typename Component>
+	Component &get(Entity e)
+	{
+		return std::get<container_for<Component> *>(included)->get(e);
+	}
+
+	// Calls f(Entity, Included &...) for every entity of this view
+	template <typename Func>
+	void each(Func f)
+	{
+		for (unsigned int i = 0, end = (unsigned int)driver->size(); i < end; i++)
+		{
+			Entity e = (*driver)[i];
+			if (accepts(e))
+				f(e, get<Included>(e)...);
+		}
+	}
+
+	// Range-for support over the entities of this view, use get<Component>(entity) in the loop body
+	class iterator
+	{
+		View *view;
+		unsigned int i, end;
+
+		void skip()
+		{
+			while (i < end && !view->accepts((*view->driver)[i]))
+				i++;
+		}
+
+	public:
+		iterator(View *view, unsigned int i, unsigned int end) : view(view), i(i), end(end) { skip(); }
+		Entity operator*() const { return (*view->driver)[i]; }
+		iterator &operator++()
+		{
+			i++;
+			skip();
+			return *this;
+		}
+		bool operator!=(const iterator &other) const { return i != other.i; }
+	};
+
+	iterator begin() { return iterator(this, 0, (unsigned int)driver->size()); }
+	iterator end() { return iterator(this, (unsigned int)driver->size(), (unsigned int)driver->size()); }
+};
+
+// Position of the type T in the list Ts, e.g. type_index<int, float, int>::value == 1
+template <typename T, typename... Ts>
+struct type_index;
+template <typename T, typename... Ts>
+struct type_index<T, T, Ts...> : std::integral_constant<unsigned int, 0>
+{
+};
+template <typename T, typename U, typename... Ts>
+struct type_index<T, U, Ts...> : std::integral_constant<unsigned int, 1 + type_index<T, Ts...>::value>
+{
+};
+
+// A registry holding one container per type of the list 'Components'
+// The containers live in a tuple and are found by type at compile time, all operations over every
+// container are expanded per type, without virtual calls. The signature bit of a component type is
+// its position in the list.
+template <typename... Components>
+class Registry
+{
+	static_assert(sizeof...(Components) <= MAX_COMPONENT_TYPES, "Too many component types for the signature");
+
+	std::tuple<container_for<Components>...> containers;
+
+	// The components owned by every entity index
+	std::vector<Signature> signatures;
+
+	// The lifetime scope of every entity index, LEVEL unless set otherwise
+	std::vector<Scope> scopes;
+
+	// Reuse the buffer of released entities across calls
+	std::vector<Entity> released;
+
+	// C++14 idiom to run an expression for every type of a parameter pack, in order
+	typedef int expand[];
+
+public:
+	Registry()
+	{
+		(void)expand{0, (get<Components>().connect(&signatures, type_index<Components, Components...>::value), 0)...};
+	}
+	// The containers point into this object
+	Registry(const Registry &) = delete;
+	Registry &operator=(const Registry &) = delete;
+
+	// Look up the container of a component type, e.g. get<Motion>()
+	template <typename Component>
+	container_for<Component> &get()
+	{
+		return std::get<container_for<Component>>(containers);
+	}
+
+	// Calls f(container) for every container, e.g. as a hook for serialization
+	template <typename Func>
+	void for_each_container(Func f)
+	{
+		(void)expand{0, (f(get<Components>()), 0)...};
+	}
+
+	// Iterate all entities with the given components, optionally skipping some, e.g.
+	// for (Entity e : registry.view<Enemy, Motion>(exclude<Chef>)) ...
+	template <typename... Included, typename... Excluded>
+	View<std::tuple<Included...>, std::tuple<Excluded...>> view(exclude_t<Excluded...> = {})
+	{
+		return View<std::tuple<Included...>, std::tuple<Excluded...>>(get<Included>()..., get<Excluded>()...);
+	}
+
+	// The set of component types an entity owns, empty for dead entities
+	Signature signature_of(Entity e)
+	{
+		if (!e.is_alive() || e.index() >= signatures.size())
+			return Signature();
+		return signatures[e.index()];
+	}
+
+	template <typename... Selected>
+	static Signature signature_mask()
+	{
+		Signature mask;
+		(void)expand{0, (mask.set(type_index<Selected, Components...>::value), 0)...};
+		return mask;
+	}
+
+	// Archetype checks as a single bit test, e.g. has_all<Enemy, Motion>(e)
+	template <typename... Selected>
+	bool has_all(Entity e)
+	{
+		Signature mask = signature_mask<Selected...>();
+		return (signature_of(e) & mask) == mask;
+	}
+	template <typename... Selected>
+	bool has_any(Entity e)
+	{
+		return (signature_of(e) & signature_mask<Selected...>()).any();
+	}
+
+	void clear_all_components()
+	{
+		(void)expand{0, (get<Components>().clear(), 0)...};
+	}
+
+	void list_all_components()
+	{
+		printf("Debug info on all registry entries:\n");
+		(void)expand{0, (get<Components>().size() > 0 ? printf("%4d components of type %s\n", (int)get<Components>().size(), typeid(Components).name()) : 0)...};
+	}
+
+	void list_all_components_of(Entity e)
+	{
+		printf("Debug info on components of entity %u:\n", (unsigned int)e);
+		Signature signature = signature_of(e);
+		(void)expand{0, (signature.test(type_index<Components, Components...>::value) ? printf("type %s\n", typeid(Components).name()) : 0)...};
+	}
+
+	// Removes all components and destroys the entity, so its index can be re-used
+	// Only the containers set in the signature of the entity are touched
+	void remove_all_components_of(Entity e)
+	{
+		if (!e.is_alive())
+			return;
+		if (e.index() < signatures.size())
+		{
+			Signature signature = signatures[e.index()];
+			(void)expand{0, (signature.test(type_index<Components, Components...>::value) ? (get<Components>().remove(e), 0) : 0)...};
+		}
+		if (e.index() < scopes.size())
+			scopes[e.index()] = Scope::LEVEL;
+		Entity::destroy(e);
+	}
+
+	void set_scope(Entity e, Scope scope)
+	{
+		if (e.index() >= scopes.size())
+			scopes.resize(e.index() + 1, Scope::LEVEL);
+		scopes[e.index()] = scope;
+	}
+
+	Scope scope_of(Entity e)
+	{
+		return e.index() < scopes.size() ? scopes[e.index()] : Scope::LEVEL;
+	}
+
+	// Removes all components of all entities in 'scope' and destroys them, in one pass per container
+	// instead of one removal per entity and container
+	void release_scope(Scope scope)
+	{
+		auto in_scope = [this, scope](Entity e)
+		{ return scope_of(e) == scope; };
+		released.clear();
+		(void)expand{0, (get<Components>().remove_if(in_scope, released), 0)...};
+
+		// Each entity is reported once, by the container that removed its last component
+		for (Entity e : released)
+		{
+			if (e.index() < scopes.size())
+				scopes[e.index()] = Scope::LEVEL;
+			Entity::destroy(e);
+		}
 	}
 };
+
+template <typename Component>
+const unsigned int ComponentContainer<Component>::SPARSE_PAGE_SIZE;
+template <typename Component>
+const unsigned int ComponentContainer<Component>::INVALID_INDEX;
@@ -3,10 +3,22 @@
 #include "ai_system.hpp"
 #include "iostream"
 #include "world_system.hpp"
+#include "physics_system.hpp"
+#include "spatial_index.hpp"
 
 extern float player_max_health;
 extern float player_max_energy;
 
+// What each kind of physics body collides with (see PhysicsBody::mask), the broad phase skips all other pairs
+// Only pairs that are resolved or have a contact handler in WorldSystem are kept
+const unsigned int PLAYER_MASK = ALL_LAYERS & ~layer_bit(CollisionLayer::WEAPON);
+const unsigned int ENEMY_MASK = layer_bit(CollisionLayer::DEFAULT) | layer_bit(CollisionLayer::PLAYER) | layer_bit(CollisionLayer::WEAPON) |
+																layer_bit(CollisionLayer::ENEMY) | layer_bit(CollisionLayer::WALL);
+const unsigned int WEAPON_MASK = layer_bit(CollisionLayer::ENEMY);
+const unsigned int PROJECTILE_MASK = layer_bit(CollisionLayer::PLAYER) | layer_bit(CollisionLayer::WALL); // damages the player, stopped by walls
+const unsigned int DAMAGE_AREA_MASK = layer_bit(CollisionLayer::PLAYER);
+const unsigned int PAN_MASK = layer_bit(CollisionLayer::PLAYER) | layer_bit(CollisionLayer::WALL);
+
 // Create floor tile entity and add to registry.
 Entity createFloorTile(RenderSystem *renderer, vec2 pos)
 {
@@ -49,15 +61,13 @@ Entity createWall(RenderSystem *renderer, vec2 pos)
 	motion.angle = 0.f;
 	motion.velocity = {0.f, 0.f};
 	motion.scale = {mesh.original_size.x * TILE_SCALE, mesh.original_size.x * TILE_SCALE};
-	motion.bb_scale = motion.scale;
-	motion.bb_offset = {0.f, 0.f};
 	motion.ignore_render_order = true;
 	motion.layer = 0;
 
 	// Print mesh size for debugging if needed
 	// std::cout << mesh.original_size.x << "," << mesh.original_size.y << std::endl;
 
-	registry.physicsBodies.insert(entity, {BodyType::STATIC});
+	// No physics body, the physics system collides against the wall tiles of the level (see tilemap_collider.hpp)
 
 	// Set up the render request for the wall
 	registry.renderRequests.insert(
@@ -111,7 +121,7 @@ Entity createSpy(RenderSystem *renderer, vec2 pos)
 	Player &player = registry.players.emplace(entity);
 	player.last_health = player_max_health;
 
-	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC});
+	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC, CollisionLayer::PLAYER, PLAYER_MASK});
 	registry.renderRequests.insert(
 			entity,
 			{TEXTURE_ASSET_ID::SPY, // TEXTURE_COUNT indicates that no texture is needed
@@ -141,7 +151,7 @@ Entity createChef(RenderSystem *renderer, vec2 pos)
 	motion.position = pos;
 	motion.angle = 0.f;
 	// motion.velocity = {0.f, 0.f};
-	motion.velocity = {70.f, 0.f};
+	set_velocity(entity, {70.f, 0.f});
 	motion.scale = mesh.original_size * 300.f;
 	motion.scale.x *= 1.6;
 	motion.bb_scale = {150.f, 130.f};
@@ -218,7 +228,7 @@ Entity createChef(RenderSystem *renderer, vec2 pos)
 
 	bossAnimation.frame_duration = 100.f; // 0.1s per frame
 
-	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC});
+	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC, CollisionLayer::ENEMY, ENEMY_MASK});
 	registry.renderRequests.insert(
 			entity,
 			{bossAnimation.attack_1[bossAnimation.current_frame], // TEXTURE_COUNT indicates that no texture is needed
@@ -229,6 +239,8 @@ Entity createChef(RenderSystem *renderer, vec2 pos)
 	registry.healths.insert(entity, {350.f, 350.f, healthbar});
 	// registry.healths.insert(entity, {5.f, 5.f, healthbar});
 
+	spatial_index.insert(entity);
+
 	return entity;
 }
 
@@ -262,7 +274,7 @@ Entity createKnight(RenderSystem *renderer, vec2 pos)
 
 	registry.meshBones.insert(entity, {renderer->skinned_meshes[(int)GEOMETRY_BUFFER_ID::KNIGHT].bones});
 
-	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC});
+	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC, CollisionLayer::ENEMY, ENEMY_MASK});
 	registry.renderRequests.insert(
 			entity,
 			{TEXTURE_ASSET_ID::KNIGHT,
@@ -273,6 +285,8 @@ Entity createKnight(RenderSystem *renderer, vec2 pos)
 	// registry.healths.insert(entity, {0.5f, 500.f, healthbar});
 	registry.healths.insert(entity, {750.f, 750.f, healthbar});
 
+	spatial_index.insert(entity);
+
 	return entity;
 }
 
@@ -307,7 +321,7 @@ Entity createRangedMinion(RenderSystem *renderer, vec2 position)
 	// spriteAnimation.current_frame = 0; // Initialize to a valid frame index
 	spriteAnimation.frame_duration = 1000.f;
 
-	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC});
+	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC, CollisionLayer::ENEMY, ENEMY_MASK});
 	registry.renderRequests.insert(
 			entity,
 			{spriteAnimation.frames[spriteAnimation.current_frame],
@@ -317,6 +331,8 @@ Entity createRangedMinion(RenderSystem *renderer, vec2 position)
 	Entity healthbar = createHealthBar(renderer, position + vec2(0.f, 50.f), entity, vec3(1.f,0.f,0.f));
 	registry.healths.insert(entity, {50.f, 50.f, healthbar});
 
+	spatial_index.insert(entity);
+
 	return entity;
 }
 
@@ -329,7 +345,7 @@ Entity createArrow(RenderSystem *renderer, vec2 position, vec2 velocity)
 
 	Motion &motion = registry.motions.emplace(entity);
 	motion.position = position;
-	motion.velocity = velocity;
+	set_velocity(entity, velocity);
 	motion.angle = atan2(velocity.y, velocity.x);
 	motion.scale = {100.f, 20.f};
 	float w = motion.scale.x;
@@ -345,7 +361,7 @@ Entity createArrow(RenderSystem *renderer, vec2 position, vec2 velocity)
 
 	registry.damages.insert(entity, {10.f});
 
-	registry.physicsBodies.insert(entity, {BodyType::PROJECTILE});
+	registry.physicsBodies.insert(entity, {BodyType::PROJECTILE, CollisionLayer::PROJECTILE, PROJECTILE_MASK});
 
 	registry.renderRequests.insert(
 			entity,
@@ -400,7 +416,7 @@ Entity createPrince(RenderSystem *renderer, vec2 pos)
 
 	registry.meshBones.insert(entity, {renderer->skinned_meshes[(int)GEOMETRY_BUFFER_ID::PRINCE].bones});
 
-	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC});
+	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC, CollisionLayer::ENEMY, ENEMY_MASK});
 	registry.renderRequests.insert(
 			entity,
 			{TEXTURE_ASSET_ID::PRINCE,
@@ -411,6 +427,8 @@ Entity createPrince(RenderSystem *renderer, vec2 pos)
 	// registry.healths.insert(entity, {0.5f, 500.f, healthbar});
 	registry.healths.insert(entity, {400.f, 400.f, healthbar});
 
+	spatial_index.insert(entity);
+
 	return entity;
 }
 
@@ -455,7 +473,7 @@ Entity createKing(RenderSystem *renderer, vec2 pos)
 
 	registry.meshBones.insert(entity, {renderer->skinned_meshes[(int)GEOMETRY_BUFFER_ID::KING].bones});
 
-	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC});
+	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC, CollisionLayer::ENEMY, ENEMY_MASK});
 	registry.renderRequests.insert(
 			entity,
 			{TEXTURE_ASSET_ID::KING,
@@ -466,6 +484,8 @@ Entity createKing(RenderSystem *renderer, vec2 pos)
 	// registry.healths.insert(entity, {0.5f, 500.f, healthbar});
 	registry.healths.insert(entity, {500.f, 500.f, healthbar});
 
+	spatial_index.insert(entity);
+
 	return entity;
 }
 
@@ -520,6 +540,8 @@ Entity createWeapon(RenderSystem *renderer, vec2 pos, WeaponType type, WeaponLev
 																	? renderer->getTexturedMesh(GEOMETRY_BUFFER_ID::DAGGER)
 																	: renderer->getTexturedMesh(GEOMETRY_BUFFER_ID::WEAPON);
 	registry.texturedMeshPtrs.emplace(entity, &weapon_mesh);
+	// hit tests against enemies use the triangles of the mesh
+	registry.meshColliders.emplace(entity);
 
 	printf("Mesh selected: %s\n",
 				 (type == WeaponType::DAGGER) ? "DAGGER" : "SWORD");
@@ -538,7 +560,7 @@ Entity createWeapon(RenderSystem *renderer, vec2 pos, WeaponType type, WeaponLev
 	motion.pivot_offset = {0.f, -0.35f};
 	motion.layer = 3;
 
-	registry.physicsBodies.insert(entity, {BodyType::NONE});
+	registry.physicsBodies.insert(entity, {BodyType::NONE, CollisionLayer::WEAPON, WEAPON_MASK});
 
 	registry.renderRequests.insert(
 			entity,
@@ -621,7 +643,7 @@ Entity createHealthBar(RenderSystem *renderer, vec2 pos, Entity owner_entity, ve
 	motion.scale = {200.f, 20.f};
 	motion.layer = 5;
 
-	registry.healthbar.insert(entity, {motion.scale});
+	registry.healthbar.insert(entity, {motion.scale, owner_entity});
 	registry.renderRequests.insert(
 			entity,
 			{TEXTURE_ASSET_ID::TEXTURE_COUNT, // TEXTURE_COUNT indicates that no texture is needed
@@ -698,7 +720,7 @@ Entity createDamageArea(Entity owner, vec2 position, vec2 scale, float damage, f
 	motion.bb_scale = scale;
 
 	registry.damages.insert(entity, {damage});
-	registry.physicsBodies.insert(entity, {BodyType::NONE});
+	registry.physicsBodies.insert(entity, {BodyType::NONE, CollisionLayer::DAMAGE_AREA, DAMAGE_AREA_MASK});
 
 	DamageArea &damage_area = registry.damageAreas.emplace(entity);
 	damage_area.owner = owner;
@@ -752,7 +774,7 @@ Entity createEnemy(RenderSystem *renderer, vec2 position)
 	Enemy &enemy = registry.enemies.emplace(entity);
 	enemy.is_minion = true;
 
-	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC});
+	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC, CollisionLayer::ENEMY, ENEMY_MASK});
 	registry.renderRequests.insert(
 			entity,
 			{spriteAnimation.frames[spriteAnimation.current_frame],
@@ -762,6 +784,8 @@ Entity createEnemy(RenderSystem *renderer, vec2 position)
 	Entity healthbar = createHealthBar(renderer, position + vec2(0.f, 50.f), entity, vec3(1.f,0.f,0.f));
 	registry.healths.insert(entity, {100.f, 100.f, healthbar});
 
+	spatial_index.insert(entity);
+
 	return entity;
 }
 
@@ -777,7 +801,7 @@ Entity createTomato(RenderSystem *renderer, vec2 position, vec2 velocity)
 	// Initialize the position, scale, and physics components
 	auto &motion = registry.motions.emplace(entity);
 	motion.angle = 0.f;
-	motion.velocity = velocity;
+	set_velocity(entity, velocity);
 	motion.position = position;
 	motion.scale = mesh.original_size * 100.f;
 	motion.scale.x *= -0.8;
@@ -787,7 +811,7 @@ Entity createTomato(RenderSystem *renderer, vec2 position, vec2 velocity)
 
 	std::cout << "create tomato" << std::endl;
 	registry.damages.insert(entity, {10.f});
-	registry.physicsBodies.insert(entity, {BodyType::PROJECTILE});
+	registry.physicsBodies.insert(entity, {BodyType::PROJECTILE, CollisionLayer::PROJECTILE, PROJECTILE_MASK});
 	registry.renderRequests.insert(
 			entity,
 			{TEXTURE_ASSET_ID::TOMATO,
@@ -810,7 +834,7 @@ Entity createPan(RenderSystem *renderer, vec2 position, vec2 velocity)
 	// Initialize the position, scale, and physics components
 	auto &motion = registry.motions.emplace(entity);
 	motion.angle = 0.f;
-	motion.velocity = velocity;
+	set_velocity(entity, velocity);
 	motion.position = position;
 	motion.scale = mesh.original_size * 200.f;
 	motion.scale.x *= -0.8;
@@ -820,7 +844,7 @@ Entity createPan(RenderSystem *renderer, vec2 position, vec2 velocity)
 
 	// Create an (empty) Bug component to be able to refer to all bug
 	registry.pans.emplace(entity, Pan(20.f));
-	registry.physicsBodies.insert(entity, {BodyType::NONE});
+	registry.physicsBodies.insert(entity, {BodyType::NONE, CollisionLayer::PAN, PAN_MASK});
 	registry.renderRequests.insert(
 			entity,
 			{TEXTURE_ASSET_ID::PAN,
@@ -862,6 +886,7 @@ Entity createLine(vec2 position, vec2 scale, vec3 color, float angle)
 	registry.colors.insert(entity, color);
 
 	registry.debugComponents.emplace(entity);
+	registry.set_scope(entity, Scope::FRAME);
 	return entity;
 }
 
@@ -887,7 +912,7 @@ Entity createSpinArea(Entity chef_entity)
 
 	registry.attachments.emplace(entity, Attachment(chef_entity));
 	registry.spinareas.emplace(entity, SpinArea());
-	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC});
+	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC, CollisionLayer::ENEMY, ENEMY_MASK});
 	return entity;
 }
 
@@ -972,6 +997,8 @@ Entity createFountain(RenderSystem *renderer, vec2 pos)
 			 EFFECT_ASSET_ID::TEXTURED,
 			 GEOMETRY_BUFFER_ID::SPRITE});
 
+	spatial_index.insert(entity);
+
 	return entity;
 }
 
@@ -999,13 +1026,15 @@ Entity createTreasureBox(RenderSystem *renderer, vec2 pos, TreasureBoxItem item,
 	treasureBox.weapon_level = weapon_level;
 	treasureBox.weapon_type = weapon_type;
 
-	registry.physicsBodies.insert(entity, {BodyType::STATIC});
+	registry.physicsBodies.insert(entity, {BodyType::STATIC, CollisionLayer::WALL});
 	registry.renderRequests.insert(
 			entity,
 			{TEXTURE_ASSET_ID::TREASURE_BOX,
 			 EFFECT_ASSET_ID::TEXTURED,
 			 GEOMETRY_BUFFER_ID::SPRITE});
 
+	spatial_index.insert(entity);
+
 	return entity;
 }
 
@@ -1069,7 +1098,7 @@ Entity createSoldier(RenderSystem *renderer, vec2 pos, float health, float damag
 
 	Enemy &enemy = registry.enemies.emplace(entity);
 
-	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC});
+	registry.physicsBodies.insert(entity, {BodyType::KINEMATIC, CollisionLayer::ENEMY, ENEMY_MASK});
 
 	Entity healthbar = createHealthBar(renderer, pos + vec2(0.f, 50.f), entity);
 	registry.healths.insert(entity, {health, health, healthbar});
@@ -1082,6 +1111,8 @@ Entity createSoldier(RenderSystem *renderer, vec2 pos, float health, float damag
 			 EFFECT_ASSET_ID::TEXTURED,
 			 GEOMETRY_BUFFER_ID::SPRITE});
 
+	spatial_index.insert(entity);
+
 	return entity;
 }
 
@@ -1101,7 +1132,8 @@ Entity createFireRain(RenderSystem *renderer, vec2 pos)
 	motion.bb_offset = {0.f, 40.f};
 	motion.layer = 1;
 
-	registry.physicsBodies.insert(entity, {BodyType::NONE});
+	// only shown, the damage is dealt by a damage area created at the same place
+	registry.physicsBodies.insert(entity, {BodyType::NONE, CollisionLayer::DEFAULT, 0});
 
 	registry.renderRequests.insert(
 			entity,
@@ -12,7 +12,7 @@ Entity createLine(vec2 position, vec2 size, vec3 color, float angle = 0.f);
 // the floor tile
 Entity createFloorTile(RenderSystem *renderer, vec2 pos);
 
-// a Wall
+// a Wall, only rendered; its collision is the wall tile set in wall_tiles
 Entity createWall(RenderSystem *renderer, vec2 pos);
 
 Entity createSpy(RenderSystem *renderer, vec2 pos);
@@ -9,6 +9,11 @@
 #include "../ext/json.hpp"
 
 #include "physics_system.hpp"
+#include "command_buffer.hpp"
+#include "tilemap_collider.hpp"
+#include "spatial_index.hpp"
+#include "flow_field.hpp"
+#include "contact_buffer.hpp"
 #include "LDtkLoader/Project.hpp"
 #include <fstream>
 
@@ -210,9 +215,22 @@ GLFWwindow *WorldSystem::create_window()
 	return window;
 }
 
-void WorldSystem::init(RenderSystem *renderer_arg)
+void WorldSystem::init(RenderSystem *renderer_arg, PhysicsSystem *physics_arg)
 {
 	this->renderer = renderer_arg;
+	this->physics = physics_arg;
+
+	// Gameplay reactions to the contacts found by the physics system, by the layers of the two bodies
+	contacts.subscribe(CollisionLayer::DAMAGE_AREA, CollisionLayer::PLAYER, [this](const Contact &contact)
+										 { on_damage_area_hits_player(contact); });
+	contacts.subscribe(CollisionLayer::PAN, CollisionLayer::PLAYER, [this](const Contact &contact)
+										 { on_pan_hits_player(contact); });
+	contacts.subscribe(CollisionLayer::PAN, CollisionLayer::WALL, [this](const Contact &contact)
+										 { on_pan_hits_wall(contact); });
+	contacts.subscribe(CollisionLayer::ENEMY, CollisionLayer::PLAYER, [this](const Contact &contact)
+										 { on_enemy_hits_player(contact); });
+	contacts.subscribe(CollisionLayer::WEAPON, CollisionLayer::ENEMY, [this](const Contact &contact)
+										 { on_weapon_hits_enemy(contact); });
 
 	// Set all states to default
 	restart_game();
@@ -227,18 +245,12 @@ float bezzy(float t, float P0, float P1, float P2)
 	return (1 - t) * (1 - t) * P0 + 2 * (1 - t) * t * P1 + t * t * P2;
 }
 
-// Update our game world
-bool WorldSystem::step(float elapsed_ms_since_last_update)
+// Count rendered frames, called once per frame rather than once per simulation step
+void WorldSystem::update_fps(float elapsed_ms, const PhysicsSystem &physics_system)
 {
-
-	elapsed_time += elapsed_ms_since_last_update / 1000.f; // ms to second convert
+	elapsed_time += elapsed_ms / 1000.f; // ms to second convert
 	frame_count++;
 
-	Player &player = registry.players.get(player_spy);
-	Motion &spy_motion = registry.motions.get(player_spy);
-	dashAvailable = player.state != PlayerState::DASHING && player.dash_cooldown_remaining_ms <= 0.0f;
-	dashInUse = (player.state == PlayerState::DASHING);
-	// saveProgress();
 	if (elapsed_time >= 1)
 	{
 		// Update FPS every second
@@ -250,11 +262,26 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 	// Update window title
 	std::stringstream title_ss;
 	title_ss << "Frames Per Second: " << fps;
+	if (debugging.in_debug_mode)
+	{
+		title_ss << " | Integrated: " << physics_system.integrated_count << " / " << registry.motions.size() << " motions";
+		title_ss << " | Pair tests: " << physics_system.pair_tests << " in " << physics_system.collision_detection_us << " us";
+	}
 	glfwSetWindowTitle(window, title_ss.str().c_str());
+}
+
+// Update our game world
+bool WorldSystem::step(float elapsed_ms_since_last_update)
+{
+
+	Player &player = registry.players.get(player_spy);
+	Motion &spy_motion = registry.motions.get(player_spy);
+	dashAvailable = player.state != PlayerState::DASHING && player.dash_cooldown_remaining_ms <= 0.0f;
+	dashInUse = (player.state == PlayerState::DASHING);
+	// saveProgress();
 
 	// Remove debug info from the last step
-	while (registry.debugComponents.entities.size() > 0)
-		registry.remove_all_components_of(registry.debugComponents.entities.back());
+	registry.release_scope(Scope::FRAME);
 
 	// TODO: Remove entities that leave the screen, using new check accounting for camera view
 	// Iterate backwards to be able to remove without unterfering with the next object to visit
@@ -310,8 +337,7 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 
 		float interpolation_factor = t * t * (3.0f - 2.0f * t); // basically 3t^2 - 2t^3 -> cubic
 
-		motion.velocity.x = (1.0f - interpolation_factor + 1.f) * interpolate.initial_velocity.x;
-		motion.velocity.y = (1.0f - interpolation_factor + 1.f) * interpolate.initial_velocity.y;
+		set_velocity(entity, (1.0f - interpolation_factor + 1.f) * interpolate.initial_velocity);
 
 		if (interpolation_factor >= 0.5f && entity == player_spy && !player.current_dodge_is_perfect)
 		{
@@ -340,35 +366,39 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 	}
 
 	// Update health bar percentage
-	for (unsigned int i = 0; i < registry.healths.size(); i++)
+	auto health_owners = registry.view<Health, Motion>();
+	for (Entity owner_entity : health_owners)
 	{
-		Health &health = registry.healths.components[i];
-		Entity owner_entity = registry.healths.entities[i];
+		Health &health = health_owners.get<Health>(owner_entity);
 		Entity health_bar_entity = health.healthbar;
 
-		if (registry.motions.has(owner_entity) && registry.motions.has(health_bar_entity))
+		if (registry.motions.has(health_bar_entity))
 		{
-			Motion &owner_motion = registry.motions.get(owner_entity);
+			Motion &owner_motion = health_owners.get<Motion>(owner_entity);
 			Motion &health_bar_motion = registry.motions.get(health_bar_entity);
 
-			// TODO: refactor the following lines code by introducing healthbar_offset and put code in renderer.draw()
+			// the renderer draws the bars of the enemies at offset_from_owner from where it draws the owner
+			vec2 offset = {0.f, 0.f};
 			if (owner_entity == player_spy)
 			{
 				health_bar_motion.position = vec2(50.f, 50.f);
 			}
 			else if (registry.chef.has(owner_entity))
 			{
-				health_bar_motion.position = owner_motion.position + vec2(-95.f, -175.f);
+				offset = vec2(-95.f, -175.f);
+				health_bar_motion.position = owner_motion.position + offset;
 			}
 			else
 			{
-				health_bar_motion.position = owner_motion.position + vec2(-105.f, -75.f);
+				offset = vec2(-105.f, -75.f);
+				health_bar_motion.position = owner_motion.position + offset;
 			}
 
 			float health_percentage = health.health / health.max_health;
 			if (registry.healthbar.has(health_bar_entity))
 			{
 				HealthBar &health_bar = registry.healthbar.get(health_bar_entity);
+				health_bar.offset_from_owner = offset;
 				health_bar_motion.scale.x = health_bar.original_scale.x * health_percentage;
 				health_bar_motion.scale.y = health_bar.original_scale.y;
 			}
@@ -380,7 +410,6 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 
 	for (int i = registry.dashes.components.size() - 1; i >= 0; i--)
 	{
-		Motion &spy_motion = registry.motions.get(player_spy);
 		dashAvailable = player.state != PlayerState::DASHING && player.dash_cooldown_remaining_ms <= 0.0f;
 		dashInUse = (player.state == PlayerState::DASHING);
 		Dash &dash = registry.dashes.components[i];
@@ -390,7 +419,7 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 		{
 			float t = dash.elapsed_time / dash.total_time_ms;
 			float scaling_factor = bezzy(t, 1.0f, 2.0f, 1.0f);
-			spy_motion.velocity = player_movement_direction * PLAYER_SPEED * scaling_factor * 2.f;
+			set_velocity(player_spy, player_movement_direction * PLAYER_SPEED * scaling_factor * 2.f);
 			// std::cout << "dash active, velocity is (" << spy_motion.velocity.x << ", " << spy_motion.velocity.y << ")" << std::endl;
 		}
 		else
@@ -447,7 +476,8 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 				// Pan returns to chef when distance < 50.
 				if (distance_to_chef < 50.f)
 				{
-					registry.remove_all_components_of(pan_entity);
+					// removed on flush, the pans are being iterated
+					commands.destroy(pan_entity);
 					Chef &chef = registry.chef.get(chef_entity);
 					chef.pan_active = false;
 				}
@@ -591,7 +621,7 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 		Health &chef_health = registry.healths.get(chef_entity);
 		if (chef_health.is_dead)
 		{
-			registry.remove_all_components_of(chef_entity);
+			commands.destroy(chef_entity);
 			trigger_dialogue(chef_death_dialogue);
 			is_in_chef_dialogue = true;
 		}
@@ -612,7 +642,7 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 		Health &knight_health = registry.healths.get(knight_entity);
 		if (knight_health.is_dead)
 		{
-			registry.remove_all_components_of(knight_entity);
+			commands.destroy(knight_entity);
 			trigger_dialogue(knight_death_dialogue);
 			is_in_knight_dialogue = true;
 		}
@@ -624,7 +654,7 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 		Health &prince_health = registry.healths.get(prince_entity);
 		if (prince_health.is_dead)
 		{
-			registry.remove_all_components_of(prince_entity);
+			commands.destroy(prince_entity);
 			trigger_dialogue(prince_death_dialogue);
 			is_in_prince_dialogue = true;
 		}
@@ -636,7 +666,7 @@ bool WorldSystem::step(float elapsed_ms_since_last_update)
 		Health &king_health = registry.healths.get(king_entity);
 		if (king_health.is_dead)
 		{
-			registry.remove_all_components_of(king_entity);
+			commands.destroy(king_entity);
 			trigger_dialogue(king_death_dialogue);
 		}
 	}
@@ -860,8 +890,10 @@ void WorldSystem::instruction_screen()
 
 void WorldSystem::load_level(const std::string &levelName, const int levelNumber)
 {
-	while (registry.motions.entities.size() > 0)
-		registry.remove_all_components_of(registry.motions.entities.back());
+	// commands recorded for the previous level must not leak into the new one
+	commands.clear();
+	registry.release_scope(Scope::FRAME);
+	registry.release_scope(Scope::LEVEL);
 
 	createBackgroundSprite(renderer, levelNumber);
 	// Debugging for memory/component leaks
@@ -890,10 +922,12 @@ void WorldSystem::load_level(const std::string &levelName, const int levelNumber
 	int gridHeight = level.size.y / TILE_SIZE;
 
 	std::vector<std::pair<Entity, vec2>> chests;
-	std::vector<std::pair<Entity, vec2>> minions;
 
 	level_grid.clear();
 	level_grid.resize(gridWidth, std::vector<int>(gridHeight, 0)); // 0 for walkable
+	wall_tiles.reset(gridWidth, gridHeight);
+	spatial_index.reset(gridWidth, gridHeight);
+	player_flow_field.reset(gridWidth, gridHeight);
 
 	for (const auto &layer : level.allLayers())
 	{
@@ -916,6 +950,7 @@ void WorldSystem::load_level(const std::string &levelName, const int levelNumber
 				else if (layer.getName() == "Wall_Tiles")
 				{
 					level_grid[gridX][gridY] = 0;
+					wall_tiles.set_solid(gridX, gridY);
 					createWall(renderer, position);
 				}
 			}
@@ -998,8 +1033,7 @@ void WorldSystem::load_level(const std::string &levelName, const int levelNumber
 				}
 				else if (entity_name == "Minions")
 				{
-					Entity minion_entity = createEnemy(renderer, position);
-					minions.push_back(std::make_pair(minion_entity, position));
+					createEnemy(renderer, position);
 				}
 				else if (entity_name == "Chef")
 				{
@@ -1046,6 +1080,7 @@ void WorldSystem::load_level(const std::string &levelName, const int levelNumber
 	const float association_distance = 600.f;
 
 	// logic for associate minion w treasure box based on initialization positon
+	std::vector<Entity> nearby;
 	for (const auto &chest_pair : chests)
 	{
 		Entity chest_entity = chest_pair.first;
@@ -1053,20 +1088,24 @@ void WorldSystem::load_level(const std::string &levelName, const int levelNumber
 		TreasureBox &treasure_box = registry.treasureBoxes.get(chest_entity);
 		std::cout << "Associating minions with chest!! " << chest_entity << std::endl;
 
-		for (const auto &minion_pair : minions)
+		nearby.clear();
+		spatial_index.query_radius(chest_position, association_distance, nearby);
+		for (Entity minion_entity : nearby)
 		{
-			Entity minion_entity = minion_pair.first;
-			vec2 minion_position = minion_pair.second;
-
-			float distance = length(chest_position - minion_position);
-			if (distance <= association_distance)
+			// only the melee minions, they have not moved since they were created
+			if (registry.enemies.has(minion_entity) && registry.enemies.get(minion_entity).is_minion)
 			{
+				float distance = length(chest_position - registry.motions.get(minion_entity).position);
 				treasure_box.associated_minions.push_back(minion_entity);
 				std::cout << " - Minion " << minion_entity << " associated with chest " << chest_entity
 									<< " (distance: " << distance / TILE_SIZE << " tiles)" << std::endl;
 			}
 		}
 	}
+
+	// the first frames of the level must not interpolate from the camera of the previous one
+	update_camera_view();
+	renderer->snap_previous_tick();
 }
 
 void WorldSystem::process_animation(AnimationName name, float t, Entity entity)
@@ -1382,11 +1421,6 @@ void WorldSystem::draw_mesh_debug(Entity mesh_entity, bool consider_bones)
 // Compute collisions between entities
 void WorldSystem::handle_collisions()
 {
-	Entity player = player_spy;
-	Player &player_comp = registry.players.get(player);
-	Entity player_weapon = player_comp.weapon;
-	Weapon &player_weapon_comp = registry.weapons.get(player_weapon);
-
 	// draw collision bounding boxes (debug lines)
 	if (debugging.in_debug_mode)
 	{
@@ -1395,7 +1429,7 @@ void WorldSystem::handle_collisions()
 			Entity entity = registry.physicsBodies.entities[i];
 			Motion &motion = registry.motions.get(entity);
 			vec3 color = {1.f, 0.f, 0.f};
-			if (registry.collisions.has(entity))
+			if (contacts.has(entity))
 			{
 				color = {0.f, 1.f, 0.f};
 			}
@@ -1455,210 +1489,214 @@ void WorldSystem::handle_collisions()
 		}
 	}
 
-	// Loop over all collisions detected by the physics system
-	// std::cout << "handle_collisions()" << std::endl;
-	auto &collisionsRegistry = registry.collisions;
-	for (uint i = 0; i < collisionsRegistry.components.size(); i++)
-	{
-		// The entity and its collider
-		Entity entity = collisionsRegistry.entities[i];
-		Entity entity_other = collisionsRegistry.components[i].other;
-		// std::cout << "entity = " << entity << " entity_other = " << entity_other << std::endl;
+	// Hand the contacts of this simulation step to the handlers subscribed in init()
+	contacts.dispatch();
+	contacts.clear();
+}
 
-		bool entity_is_damage_area = registry.damageAreas.has(entity);
-		if (entity_is_damage_area && entity_other == player)
-		{
-			DamageArea &damage_area = registry.damageAreas.get(entity);
-			if (damage_area.active)
-			{
-				if (player_comp.can_take_damage())
-				{
-					Damage &damage = registry.damages.get(entity);
-					Health &player_health = registry.healths.get(player);
-					player_health.take_damage(damage.damage);
-					std::cout << "Damage area hit player for " << damage.damage << " damage" << std::endl;
-				}
-				else
-				{
-					Damage &damage = registry.damages.get(entity);
-					std::cout << "Player prevented " << damage.damage << " damage by dodging" << std::endl;
-				}
+// A damage area touches the player
+void WorldSystem::on_damage_area_hits_player(const Contact &contact)
+{
+	Entity entity = contact.a;
+	Entity player = contact.b;
+	Player &player_comp = registry.players.get(player);
 
-				if (damage_area.single_damage)
-				{
-					damage_area.time_until_destroyed = 0.f; // immediately destroy the damage area
-				}
-				else
-				{
-					damage_area.time_until_active = damage_area.damage_cooldown;
-					damage_area.active = false;
-				}
-			}
+	DamageArea &damage_area = registry.damageAreas.get(entity);
+	if (damage_area.active)
+	{
+		if (player_comp.can_take_damage())
+		{
+			Damage &damage = registry.damages.get(entity);
+			Health &player_health = registry.healths.get(player);
+			player_health.take_damage(damage.damage);
+			std::cout << "Damage area hit player for " << damage.damage << " damage" << std::endl;
 		}
-
-		// When pan hits player
-		bool entity_is_pan = registry.pans.has(entity);
-		if (entity_is_pan && entity_other == player)
+		else
 		{
-			Pan &pan = registry.pans.get(entity);
-
-			if (pan.player_hit == false)
-			{
-				pan.player_hit = true;
-				if (player_comp.can_take_damage())
-				{
-					Health &player_spy_health = registry.healths.get(player_spy);
-					player_spy_health.take_damage(pan.damage);
-				}
-			}
-			pan.state = PanState::RETURNING;
-			for (Entity chef_entity : registry.chef.entities)
-			{
-				Motion &chef_motion = registry.motions.get(chef_entity);
-				Motion &pan_motion = registry.motions.get(entity);
-				vec2 direction_to_chef = normalize(chef_motion.position - pan_motion.position);
-				pan_motion.velocity = direction_to_chef * 400.f;
-			}
+			Damage &damage = registry.damages.get(entity);
+			std::cout << "Player prevented " << damage.damage << " damage by dodging" << std::endl;
 		}
 
-		// When pan hits wall
-		bool entity_other_is_wall = registry.physicsBodies.has(entity_other) && registry.physicsBodies.get(entity_other).body_type == BodyType::STATIC;
-		if (entity_is_pan && entity_other_is_wall)
+		if (damage_area.single_damage)
 		{
-			Pan &pan = registry.pans.get(entity);
-			pan.state = PanState::RETURNING;
-			for (Entity chef_entity : registry.chef.entities)
-			{
-				Motion &chef_motion = registry.motions.get(chef_entity);
-				Motion &pan_motion = registry.motions.get(entity);
-				vec2 direction_to_chef = normalize(chef_motion.position - pan_motion.position);
-				pan_motion.velocity = direction_to_chef * 400.f;
-			}
+			damage_area.time_until_destroyed = 0.f; // immediately destroy the damage area
+		}
+		else
+		{
+			damage_area.time_until_active = damage_area.damage_cooldown;
+			damage_area.active = false;
 		}
+	}
+}
+
+// When pan hits player
+void WorldSystem::on_pan_hits_player(const Contact &contact)
+{
+	Entity entity = contact.a;
+	Player &player_comp = registry.players.get(contact.b);
+
+	Pan &pan = registry.pans.get(entity);
 
-		// When dash hits player
-		bool entity_is_chef = registry.chef.has(entity);
-		if (entity_is_chef && entity_other == player)
+	if (pan.player_hit == false)
+	{
+		pan.player_hit = true;
+		if (player_comp.can_take_damage())
 		{
-			Chef &chef = registry.chef.get(entity);
 			Health &player_spy_health = registry.healths.get(player_spy);
+			player_spy_health.take_damage(pan.damage);
+		}
+	}
+	pan.state = PanState::RETURNING;
+	for (Entity chef_entity : registry.chef.entities)
+	{
+		Motion &chef_motion = registry.motions.get(chef_entity);
+		Motion &pan_motion = registry.motions.get(entity);
+		vec2 direction_to_chef = normalize(chef_motion.position - pan_motion.position);
+		set_velocity(entity, direction_to_chef * 400.f);
+	}
+}
 
-			if (!chef.dash_has_damaged && player_comp.can_take_damage())
-			{
-				float damage = 10.f;
-				player_spy_health.take_damage(damage);
-				chef.dash_has_damaged = true;
-			}
+// When pan hits a wall tile or another static body
+void WorldSystem::on_pan_hits_wall(const Contact &contact)
+{
+	Entity entity = contact.a;
+
+	Pan &pan = registry.pans.get(entity);
+	pan.state = PanState::RETURNING;
+	for (Entity chef_entity : registry.chef.entities)
+	{
+		Motion &chef_motion = registry.motions.get(chef_entity);
+		Motion &pan_motion = registry.motions.get(entity);
+		vec2 direction_to_chef = normalize(chef_motion.position - pan_motion.position);
+		set_velocity(entity, direction_to_chef * 400.f);
+	}
+}
+
+// When dash hits player
+void WorldSystem::on_enemy_hits_player(const Contact &contact)
+{
+	Entity entity = contact.a;
+	Player &player_comp = registry.players.get(contact.b);
+
+	if (registry.chef.has(entity))
+	{
+		Chef &chef = registry.chef.get(entity);
+		Health &player_spy_health = registry.healths.get(player_spy);
+
+		if (!chef.dash_has_damaged && player_comp.can_take_damage())
+		{
+			float damage = 10.f;
+			player_spy_health.take_damage(damage);
+			chef.dash_has_damaged = true;
 		}
+	}
+}
+
+// The player's weapon hits an enemy
+void WorldSystem::on_weapon_hits_enemy(const Contact &contact)
+{
+	Entity entity = contact.a;
+	Entity entity_other = contact.b;
+	Player &player_comp = registry.players.get(player_spy);
+	Entity player_weapon = player_comp.weapon;
+	Weapon &player_weapon_comp = registry.weapons.get(player_weapon);
 
-		if (entity == player_weapon && registry.enemies.has(entity_other))
+	if (entity == player_weapon && registry.enemies.has(entity_other))
+	{
+		if (registry.healths.has(entity_other))
 		{
-			if (registry.healths.has(entity_other))
+			Health &enemy_health = registry.healths.get(entity_other);
+			if (enemy_health.is_dead)
 			{
-				Health &enemy_health = registry.healths.get(entity_other);
-				if (enemy_health.is_dead)
-				{
-					// Enemy is dead; skip collision processing
-					continue;
-				}
+				// Enemy is dead; skip collision processing
+				return;
 			}
+		}
 
-			Enemy &enemy = registry.enemies.get(entity_other);
+		Enemy &enemy = registry.enemies.get(entity_other);
 
-			if (player_comp.state == PlayerState::LIGHT_ATTACK || player_comp.state == PlayerState::HEAVY_ATTACK)
+		if (player_comp.state == PlayerState::LIGHT_ATTACK || player_comp.state == PlayerState::HEAVY_ATTACK)
+		{
+			if (enemy.last_hit_attack_id != player_comp.current_attack_id)
 			{
-				if (enemy.last_hit_attack_id != player_comp.current_attack_id)
-				{
-					enemy.last_hit_attack_id = player_comp.current_attack_id;
-				}
-				else
-				{
-					// Skip collision processing if the enemy has already been hit by this attack
-					continue;
-				}
+				enemy.last_hit_attack_id = player_comp.current_attack_id;
+			}
+			else
+			{
+				// Skip collision processing if the enemy has already been hit by this attack
+				return;
+			}
 
-				float damage = (player_comp.state == PlayerState::LIGHT_ATTACK)
-													 ? player_weapon_comp.damage * player_comp.damage_multiplier
-													 : player_weapon_comp.damage * 2.5 * player_comp.damage_multiplier;
+			float damage = (player_comp.state == PlayerState::LIGHT_ATTACK)
+												 ? player_weapon_comp.damage * player_comp.damage_multiplier
+												 : player_weapon_comp.damage * 2.5 * player_comp.damage_multiplier;
 
-				// printf("Player attack type: %s, Damage: %.2f\n",
-				//			 player_comp.state == PlayerState::LIGHT_ATTACK ? "Light" : "Heavy",
-				//			 damage);
+			// printf("Player attack type: %s, Damage: %.2f\n",
+			//			 player_comp.state == PlayerState::LIGHT_ATTACK ? "Light" : "Heavy",
+			//			 damage);
 
-				if (registry.healths.has(entity_other))
-				{
-					Health &enemy_health = registry.healths.get(entity_other);
+			if (registry.healths.has(entity_other))
+			{
+				Health &enemy_health = registry.healths.get(entity_other);
 
-					// Special behavior when damaging the King boss
-					if (registry.king.has(entity_other))
+				// Special behavior when damaging the King boss
+				if (registry.king.has(entity_other))
+				{
+					King &king = registry.king.get(entity_other);
+					if (king.is_invincible)
 					{
-						King &king = registry.king.get(entity_other);
-						if (king.is_invincible)
-						{
-							continue;
-						}
-						if (enemy_health.health - damage <= 0.f && !king.is_second_stage)
-						{
-							king.is_second_stage = true;
-							enemy_health.max_health = 600.f;
-							enemy_health.health = 600.f;
-							king.health_percentage = 1.f;
-							continue;
-						}
+						return;
 					}
-
-					enemy_health.take_damage(damage);
-
-					if (player_comp.state == PlayerState::LIGHT_ATTACK)
+					if (enemy_health.health - damage <= 0.f && !king.is_second_stage)
 					{
-						Flow &flow = registry.flows.get(flowMeterEntity);
-						flow.flowLevel = std::min(flow.flowLevel + 10.f, flow.maxFlowLevel);
+						king.is_second_stage = true;
+						enemy_health.max_health = 600.f;
+						enemy_health.health = 600.f;
+						king.health_percentage = 1.f;
+						return;
 					}
+				}
+
+				enemy_health.take_damage(damage);
 
-					// std::cout << "Enemy health: " << enemy_health.health << ", damage: " << damage << std::endl;
+				if (player_comp.state == PlayerState::LIGHT_ATTACK)
+				{
+					Flow &flow = registry.flows.get(flowMeterEntity);
+					flow.flowLevel = std::min(flow.flowLevel + 10.f, flow.maxFlowLevel);
 				}
+
+				// std::cout << "Enemy health: " << enemy_health.health << ", damage: " << damage << std::endl;
 			}
 		}
+	}
 
-		if (entity == player_weapon && registry.knight.has(entity_other))
-		{
-			Knight &knight = registry.knight.get(entity_other);
-			Player &player = registry.players.get(player_spy);
+	if (entity == player_weapon && registry.knight.has(entity_other))
+	{
+		Knight &knight = registry.knight.get(entity_other);
+		Player &player = registry.players.get(player_spy);
 
-			if (knight.shield_active)
-			{
-				knight.shield_broken = true;
-				knight.shield_active = false;
+		if (knight.shield_active)
+		{
+			knight.shield_broken = true;
+			knight.shield_active = false;
 
-				std::cout << "Shield broken by player, player takes " << (player.attack_damage * 1.5f) << " damage" << std::endl;
+			std::cout << "Shield broken by player, player takes " << (player.attack_damage * 1.5f) << " damage" << std::endl;
 
-				Health &player_health = registry.healths.get(player_spy);
-				player_health.take_damage(player.attack_damage * 1.5f);
+			Health &player_health = registry.healths.get(player_spy);
+			player_health.take_damage(player.attack_damage * 1.5f);
 
-				if (registry.boneAnimations.has(entity_other))
+			if (registry.boneAnimations.has(entity_other))
+			{
+				BoneAnimation &bone_animation = registry.boneAnimations.get(entity_other);
+				if (bone_animation.elapsed_time < 2500.f)
 				{
-					BoneAnimation &bone_animation = registry.boneAnimations.get(entity_other);
-					if (bone_animation.elapsed_time < 2500.f)
-					{
-						// play shield back to original position animation
-						bone_animation.elapsed_time = 2500.f;
-						bone_animation.current_keyframe = 2;
-					}
+					// play shield back to original position animation
+					bone_animation.elapsed_time = 2500.f;
+					bone_animation.current_keyframe = 2;
 				}
 			}
 		}
-
-		// The entity and its collider
-		// Entity entity = collisionsRegistry.entities[i];
-		// Entity entity_other = collisionsRegistry.components[i].other;
-
-		// registry.list_all_components_of(entity);
-
-		// std::cout << "entity = " << entity << " entity_other = " << entity_other << " DONE" << std::endl;
 	}
-
-	// Remove all collisions from this simulation step
-	registry.collisions.clear();
 }
 
 // Should the game be over ?
@@ -1936,13 +1974,14 @@ void WorldSystem::on_key(int key, int, int action, int mod)
 	{
 		Motion &player_motion = registry.motions.get(player_spy);
 
+		// Fountains and treasure boxes within reach of the player
+		std::vector<Entity> nearby;
+		spatial_index.query_radius(player_motion.position, 150.f, nearby);
+
 		// Check for fountain interaction
-		for (Entity &fountain : registry.fountains.entities)
+		for (Entity fountain : nearby)
 		{
-			Motion &fountain_motion = registry.motions.get(fountain);
-
-			float distance = glm::length(player_motion.position - fountain_motion.position);
-			if (distance <= 150.f)
+			if (registry.fountains.has(fountain))
 			{
 				Health &player_health = registry.healths.get(player_spy);
 				player_health.health = player_health.max_health;
@@ -1953,15 +1992,12 @@ void WorldSystem::on_key(int key, int, int action, int mod)
 		}
 
 		// Check for treasure box interaction
-		for (unsigned int i = 0; i < registry.treasureBoxes.components.size(); i++)
+		for (Entity treasure_box_entity : nearby)
 		{
-			Entity &treasure_box_entity = registry.treasureBoxes.entities[i];
-			Motion &treasure_box_motion = registry.motions.get(treasure_box_entity);
-			float distance_to_player = length(treasure_box_motion.position - player_motion.position);
-
-			if (distance_to_player < 150.f)
+			if (registry.treasureBoxes.has(treasure_box_entity))
 			{
-				TreasureBox &treasure_box = registry.treasureBoxes.components[i];
+				TreasureBox &treasure_box = registry.treasureBoxes.get(treasure_box_entity);
+				Motion &treasure_box_motion = registry.motions.get(treasure_box_entity);
 
 				bool all_minions_defeated = false;
 
@@ -2061,7 +2097,7 @@ void WorldSystem::on_key(int key, int, int action, int mod)
 					else
 					{
 						std::cout << "Treasure box already opened" << std::endl;
-						if (treasure_box.item != TreasureBoxItem::NONE && treasure_box.item_entity != 0)
+						if (treasure_box.item != TreasureBoxItem::NONE && treasure_box.item_entity.is_alive())
 						{
 							std::string item_name = "";
 							std::string item_description = "";
@@ -2178,7 +2214,7 @@ void WorldSystem::on_key(int key, int, int action, int mod)
 		{
 			speed_multiplier = SPRINTING_MULTIPLIER;
 		}
-		motion.velocity = player_movement_direction * PLAYER_SPEED * speed_multiplier;
+		set_velocity(player_spy, player_movement_direction * PLAYER_SPEED * speed_multiplier);
 	}
 
 	if (action == GLFW_PRESS && key == GLFW_KEY_1)
@@ -2518,8 +2554,7 @@ void WorldSystem::player_action_finished()
 	{
 		player.state = PlayerState::IDLE;
 	}
-	Motion &player_motion = registry.motions.get(player_spy);
-	player_motion.velocity = player_movement_direction * PLAYER_SPEED * (player.state == PlayerState::SPRINTING ? SPRINTING_MULTIPLIER : 1.f);
+	set_velocity(player_spy, player_movement_direction * PLAYER_SPEED * (player.state == PlayerState::SPRINTING ? SPRINTING_MULTIPLIER : 1.f));
 }
 
 void WorldSystem::update_energy(float energy_time)
@@ -2657,6 +2692,8 @@ bool WorldSystem::perform_teleport_backstab(Entity player_spy)
 	// Teleport the player_spy to the backstab position
 	spy_motion.position = backstab_position;
 	update_camera_view();
+	renderer->snap_previous_tick(player_spy);
+	renderer->previous_camera_position = renderer->camera_position;
 	// printf("Player position: (%.2f, %.2f)\n", spy_motion.position.x, spy_motion.position.y);
 	// printf("Camera position: (%.2f, %.2f)\n", renderer->camera_position.x, renderer->camera_position.y);
 
@@ -2678,27 +2715,10 @@ Entity WorldSystem::find_nearest_enemy(Entity player_spy)
 	Motion &spy_motion = registry.motions.get(player_spy);
 	vec2 spy_position = spy_motion.position;
 
-	Entity nearest_enemy = static_cast<Entity>(0);
-	float min_distance = std::numeric_limits<float>::max();
-
-	for (Entity enemy : registry.enemies.entities)
-	{
-		Health &enemy_health = registry.healths.get(enemy);
-		if (enemy_health.is_dead)
-		{
-			continue;
-		}
-
-		Motion &enemy_motion = registry.motions.get(enemy);
-		float distance = length(spy_position - enemy_motion.position);
-		if (distance < min_distance)
-		{
-			min_distance = distance;
-			nearest_enemy = enemy;
-		}
-	}
-
-	return nearest_enemy;
+	// enemies behind walls cannot be reached
+	return spatial_index.nearest(spy_position, std::numeric_limits<float>::max(), [&](Entity enemy)
+															 { return registry.enemies.has(enemy) && !registry.healths.get(enemy).is_dead &&
+																				physics->line_of_sight(spy_position, registry.motions.get(enemy).position); });
 }
 
 void WorldSystem::saveProgress()
@@ -12,6 +12,8 @@
 #include <SDL_mixer.h>
 
 #include "render_system.hpp"
+#include "physics_system.hpp"
+#include "contact_buffer.hpp"
 // #include "dialogue_system.hpp"
 
 // Container for all our entities and game logic. Individual rendering / update is
@@ -25,7 +27,7 @@ public:
 	GLFWwindow *create_window();
 
 	// starts the game
-	void init(RenderSystem *renderer);
+	void init(RenderSystem *renderer, PhysicsSystem *physics);
 
 	// Releases all associated resources
 	~WorldSystem();
@@ -33,6 +35,9 @@ public:
 	// Steps the game ahead by ms milliseconds
 	bool step(float elapsed_ms);
 
+	// Updates the FPS counter, once per rendered frame; in debug mode the title also shows the physics counters of the last step
+	void update_fps(float elapsed_ms, const PhysicsSystem &physics_system);
+
 	// Check for collisions
 	void handle_collisions();
 
@@ -65,6 +70,13 @@ private:
 
 	void draw_mesh_debug(Entity mesh_entity, bool consider_bones = false);
 
+	// Contact handlers, subscribed to their pair of collision layers in init()
+	void on_damage_area_hits_player(const Contact &contact);
+	void on_pan_hits_player(const Contact &contact);
+	void on_pan_hits_wall(const Contact &contact);
+	void on_enemy_hits_player(const Contact &contact);
+	void on_weapon_hits_enemy(const Contact &contact);
+
 	// Input callback functions
 	void on_key(int key, int, int action, int mod);
 	void on_mouse_move(vec2 pos);
@@ -78,6 +90,7 @@ private:
 
 	// Game state
 	RenderSystem *renderer;
+	PhysicsSystem *physics;
 	Entity player_salmon;
 	Entity player_spy;
 	Entity flowMeterEntity;